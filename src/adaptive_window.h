@@ -0,0 +1,72 @@
+/**
+ * @file      adaptive_window.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Number of requests that may be outstanding at the meter, adapted to how the meter responds
+ */
+#pragma once
+
+#include <Arduino.h>
+
+namespace modbus
+{
+    // AdaptiveWindow. Additive increase while the meter answers promptly, multiplicative decrease on timeouts,
+    // like TCP congestion control. The window grows by one after a full window of prompt responses.
+    // A timeout also lowers the ceiling to just below the window that timed out, so the window does not keep
+    // running into the same limit of the meter. The ceiling is raised again after probe_after prompt responses,
+    // an interval that doubles with every timeout.
+    class AdaptiveWindow
+    {
+    public:
+        AdaptiveWindow(uint8_t max_size = 4, uint16_t prompt_ms = 200, uint16_t probe_after = 64)
+            : _max_size(max_size < 1 ? 1 : max_size), _prompt_ms(prompt_ms), _probe_after(probe_after), _ceiling(_max_size), _probe(probe_after)
+        {
+        }
+
+        uint8_t size() const
+        {
+            return _size;
+        }
+        void onResponse(unsigned long latency_ms)
+        {
+            if (latency_ms > _prompt_ms)
+            {
+                _credit = 0;
+                return;
+            }
+            if (_credit < UINT16_MAX)
+                _credit++;
+            if (_size < _ceiling && _credit >= _size)
+            {
+                _size++;
+                _credit = 0;
+            }
+            else if (_size == _ceiling && _ceiling < _max_size && _credit >= _probe)
+            {
+                _ceiling++;
+                _size++;
+                _credit = 0;
+            }
+        }
+        void onTimeout()
+        {
+            _ceiling = _size > 1 ? _size - 1 : 1;
+            _probe = _probe < max_probe / 2 ? _probe * 2 : max_probe;
+            _size = _size > 1 ? _size / 2 : 1;
+            _credit = 0;
+        }
+
+        uint8_t _max_size;
+        uint16_t _prompt_ms;
+        uint16_t _probe_after;
+
+    private:
+        static constexpr uint16_t max_probe = 8192;
+        uint8_t _ceiling;
+        uint16_t _probe;
+        uint8_t _size = 1;
+        uint16_t _credit = 0;
+    };
+}
@@ -0,0 +1,112 @@
+/**
+ * @file      alloc_counter.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Instrumentation counting heap allocations, to verify hot paths do not allocate
+ */
+#include "alloc_counter.h"
+
+#ifdef MODBUS_ALLOC_COUNTER
+#include <atomic>
+#ifdef ESP_PLATFORM
+// FreeRTOS comes with Arduino.h
+typedef TaskHandle_t Task;
+static Task currentTask()
+{
+    return xTaskGetCurrentTaskHandle();
+}
+#else
+#include <pthread.h>
+typedef pthread_t Task;
+static Task currentTask()
+{
+    return pthread_self();
+}
+#endif
+
+// The counted tasks. A slot is only written by its own task, after it was published by raising numberTasks.
+struct Counter
+{
+    Task _task;
+    uint32_t _allocations;
+};
+static Counter counters[modbus::max_counted_tasks];
+static std::atomic<uint8_t> numberTasks(0);
+static std::atomic<uint8_t> claimedTasks(0);
+
+static Counter *counter()
+{
+    Task task = currentTask();
+    uint8_t n = numberTasks.load(std::memory_order_acquire);
+    for (uint8_t i = 0; i < n; i++)
+    {
+        if (counters[i]._task == task)
+            return &counters[i];
+    }
+    return nullptr;
+}
+static void count()
+{
+    Counter *c = counter();
+    if (c != nullptr)
+        c->_allocations++;
+}
+
+// The linker redirects every call to malloc, calloc and realloc to the __wrap_ functions
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t n, size_t size);
+    void *__real_realloc(void *p, size_t size);
+
+    void *__wrap_malloc(size_t size)
+    {
+        count();
+        return __real_malloc(size);
+    }
+    void *__wrap_calloc(size_t n, size_t size)
+    {
+        count();
+        return __real_calloc(n, size);
+    }
+    void *__wrap_realloc(void *p, size_t size)
+    {
+        count();
+        return __real_realloc(p, size);
+    }
+}
+
+void modbus::countAllocations()
+{
+    if (counter() != nullptr)
+        return;
+    uint8_t i = claimedTasks++;
+    if (i >= max_counted_tasks)
+    {
+        Serial.printf("ERROR: more than %u tasks count allocations\r\n", max_counted_tasks);
+        return;
+    }
+    counters[i] = {currentTask(), 0};
+    // Slots are claimed in order, publish them in order too
+    uint8_t expected = i;
+    while (!numberTasks.compare_exchange_weak(expected, i + 1, std::memory_order_release))
+        expected = i;
+}
+
+uint32_t modbus::allocationCount()
+{
+    Counter *c = counter();
+    return c != nullptr ? c->_allocations : 0;
+}
+#else
+void modbus::countAllocations()
+{
+}
+
+uint32_t modbus::allocationCount()
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file      alloc_counter.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Instrumentation counting heap allocations, to verify hot paths do not allocate
+ */
+#pragma once
+
+#include <Arduino.h>
+
+namespace modbus
+{
+    // Count the heap allocations of the calling task from now on, next to those of the other tasks that called this.
+    // Allocations of other tasks, e.g. the network stack or the web server, are not counted. At most max_counted_tasks.
+    void countAllocations();
+    static constexpr uint8_t max_counted_tasks = 8;
+
+    // Number of heap allocations (malloc, calloc and realloc) of the calling task since it called countAllocations.
+    // Only counts when built with -DMODBUS_ALLOC_COUNTER and the matching --wrap linker flags, see platformio.ini.
+    // Always returns 0 otherwise.
+    uint32_t allocationCount();
+}
@@ -0,0 +1,238 @@
+/**
+ * @file      connection.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      State of the connection to a meter, reconnecting without blocking the loop
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+#include "transport.h"
+#include <lwip/sockets.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace modbus
+{
+    // TcpConnect. Non blocking TCP connect to the meter. ModbusTCP::connect blocks until the connection is made or
+    // times out, which stalls the loop when the meter is unreachable. Instead the connection is made here and the
+    // socket is handed to the transport once it is connected, see ClientTransport::attach. The meter only ever sees
+    // this one connection, it has few connection slots.
+    class TcpConnect
+    {
+    public:
+        ~TcpConnect()
+        {
+            stop();
+        }
+        bool start(const IPAddress &remote, uint16_t port)
+        {
+            stop();
+            _fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (_fd < 0)
+                return false;
+            fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = uint32_t(remote);
+            if (connect(_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+            {
+                stop();
+                return false;
+            }
+            return true;
+        }
+        // 1 when connected, 0 while in progress, -1 when refused or failed
+        int8_t check()
+        {
+            if (_fd < 0)
+                return -1;
+            fd_set w;
+            FD_ZERO(&w);
+            FD_SET(_fd, &w);
+            struct timeval tv = {0, 0};
+            int n = select(_fd + 1, 0, &w, 0, &tv);
+            if (n == 0)
+                return 0;
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (n < 0 || getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+                return -1;
+            return 1;
+        }
+        void stop()
+        {
+            if (_fd >= 0)
+                close(_fd);
+            _fd = -1;
+        }
+        // Give up the connected socket, the caller closes it
+        int release()
+        {
+            int fd = _fd;
+            _fd = -1;
+            return fd;
+        }
+
+    private:
+        int _fd = -1;
+    };
+
+    // State of the connection to a meter
+    //   connecting    connecting to the meter without blocking, no requests are sent
+    //   up            requests are answered
+    //   degraded      the last request timed out, requests are sent but the in-flight window is small
+    //   open_circuit  the meter failed, nothing is sent until the backoff time has passed, then it is connected to again
+    enum class ConnectionState
+    {
+        connecting,
+        up,
+        degraded,
+        open_circuit
+    };
+
+    // Connection. Circuit breaker around the connection to a meter. After max_timeouts consecutive timeouts, or a failed
+    // connect, the circuit opens for a backoff time that doubles with every failure up to max_backoff. The time is drawn
+    // between half and the full backoff, so several gateways or meters do not retry in step. After the backoff the meter
+    // is connected to again (half open) and a single request has to succeed before the connection is up again.
+    class Connection
+    {
+    public:
+        Connection(ClientTransport &tcp, const IPAddress &remote, uint16_t port = 502)
+            : _tcp(tcp), _remote(remote), _port(port)
+        {
+        }
+
+        // Drive the state machine, never blocking on an unreachable meter. Returns true if requests may be sent.
+        bool poll(unsigned long now)
+        {
+            switch (_state)
+            {
+            case ConnectionState::open_circuit:
+                if ((long)(now - _retryAt) < 0)
+                    return false;
+                startConnect(now);
+                return false;
+            case ConnectionState::connecting:
+            {
+                int8_t connected = _connect.check();
+                if (connected == 0 && now - _connectStarted < connect_timeout)
+                    return false;
+                if (connected <= 0 || !_tcp.attach(_remote, _connect.release()))
+                {
+                    _connect.stop();
+                    Serial.printf("Meter %s not reachable, retry in %lu ms\r\n", _remote.toString().c_str(), nextBackoff());
+                    open(now);
+                    return false;
+                }
+                // Half open: the first request decides whether the connection is up
+                _state = ConnectionState::degraded;
+                _connects++;
+                return true;
+            }
+            default:
+                if (_tcp.isConnected(_remote))
+                    return true;
+                Serial.printf("Meter %s connection lost\r\n", _remote.toString().c_str());
+                startConnect(now);
+                return false;
+            }
+        }
+
+        // Time until poll has something to do, at most limit. While connecting the socket is checked every connect_check.
+        // A lost connection shows as a readable socket, see ClientTransport::socket.
+        unsigned long nextPoll(unsigned long now, unsigned long limit) const
+        {
+            switch (_state)
+            {
+            case ConnectionState::open_circuit:
+                return std::min((unsigned long)std::max(long(_retryAt - now), 0l), limit);
+            case ConnectionState::connecting:
+                return std::min(connect_check, limit);
+            default:
+                return limit;
+            }
+        }
+
+        // A request was answered
+        void onSuccess()
+        {
+            _state = ConnectionState::up;
+            _timeouts = 0;
+            _failures = 0;
+        }
+        // A request timed out. Returns true if the circuit opened, outstanding requests are then dropped.
+        bool onTimeout(unsigned long now)
+        {
+            if (++_timeouts < max_timeouts)
+            {
+                _state = ConnectionState::degraded;
+                return false;
+            }
+            Serial.printf("Meter %s does not respond, reset connection\r\n", _remote.toString().c_str());
+            _tcp.disconnect(_remote); // Close connection to slave and
+            _tcp.dropTransactions();  // Cancel all waiting transactions
+            open(now);
+            return true;
+        }
+
+        ConnectionState state() const
+        {
+            return _state;
+        }
+        const char *stateName() const
+        {
+            static const char *names[] = {"connecting", "up", "degraded", "open circuit"};
+            return names[int(_state)];
+        }
+
+        // The timeouts adapt to the response time of the meter and double with every timeout, see RttEstimator.
+        // Three in a row take about as long as one fixed timeout of the library.
+        uint8_t max_timeouts = 3;
+        uint32_t _connects = 0;
+
+    private:
+        static constexpr unsigned long min_backoff = 500;
+        static constexpr unsigned long max_backoff = 30000;
+        static constexpr unsigned long connect_timeout = 3000;
+        static constexpr unsigned long connect_check = 10;
+
+        unsigned long nextBackoff() const
+        {
+            return std::min(min_backoff << std::min<uint8_t>(_failures, 16), max_backoff);
+        }
+        void open(unsigned long now)
+        {
+            unsigned long backoff = nextBackoff();
+            backoff = backoff / 2 + esp_random() % (backoff / 2 + 1);
+            _retryAt = now + backoff;
+            if (_failures < UINT8_MAX)
+                _failures++;
+            _timeouts = 0;
+            _state = ConnectionState::open_circuit;
+        }
+        void startConnect(unsigned long now)
+        {
+            _connectStarted = now;
+            _state = ConnectionState::connecting;
+            if (!_connect.start(_remote, _port))
+                open(now);
+        }
+
+        ClientTransport &_tcp;
+        IPAddress _remote;
+        uint16_t _port;
+        // Start as if the circuit just opened, with the retry due immediately
+        ConnectionState _state = ConnectionState::open_circuit;
+        TcpConnect _connect;
+        unsigned long _retryAt = 0;
+        unsigned long _connectStarted = 0;
+        uint8_t _failures = 0;
+        uint8_t _timeouts = 0;
+    };
+}
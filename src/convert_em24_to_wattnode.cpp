@@ -9,69 +9,152 @@
 
 #include "Arduino.h"
 #include "convert_em24_to_wattnode.h"
+#include "alloc_counter.h"
 
 void modbus::ConvertEM24ToWattNode::CopyDataFromMasterToSlave()
 {   
+    uint32_t allocations = allocationCount();
     //Serial.printf("CopyDateFromEM24ToWattnode\n\r");
+    // One consistent copy per block, a response that arrives meanwhile does not mix into this conversion
+    _meter.snapshot(_snapshot);
     // Block 1000
-    _wattnode.setFloatValue(WattNode::energy_active, _meter.getFloatValue(EM24::import_energy_active)+_meter.getFloatValue(EM24::export_energy_active));// # total active energy
-    _wattnode.setFloatValue(WattNode::import_energy_active, _meter.getFloatValue(EM24::import_energy_active));//  # imported active energy
-    _wattnode.setFloatValue(WattNode::energy_active_nr, _meter.getFloatValue(EM24::import_energy_active)+_meter.getFloatValue(EM24::export_energy_active));//  # total active energy non-reset
-    _wattnode.setFloatValue(WattNode::import_energy_active_nr, _meter.getFloatValue(EM24::import_energy_active));//  # imported active energy non-reset
-    _wattnode.setFloatValue(WattNode::power_active, _meter.getFloatValue(EM24::power_active));//  # total power
-    _wattnode.setFloatValue(WattNode::l1_power_active, _meter.getFloatValue(EM24::l1_power_active));
-    _wattnode.setFloatValue(WattNode::l2_power_active, _meter.getFloatValue(EM24::l2_power_active));
-    _wattnode.setFloatValue(WattNode::l3_power_active, _meter.getFloatValue(EM24::l3_power_active));
-    _wattnode.setFloatValue(WattNode::voltage_ln, _meter.getFloatValue(EM24::voltage_ln));//  # l-n voltage
-    _wattnode.setFloatValue(WattNode::l1n_voltage, _meter.getFloatValue(EM24::l1_voltage));//  # l1-n voltage
-    _wattnode.setFloatValue(WattNode::l2n_voltage, _meter.getFloatValue(EM24::l2_voltage));//  # l2-n voltage
-    _wattnode.setFloatValue(WattNode::l3n_voltage, _meter.getFloatValue(EM24::l3_voltage));//  # l3-n voltage
-    _wattnode.setFloatValue(WattNode::voltage_ll, _meter.getFloatValue(EM24::voltage_ll));//  # l-l voltage
-    _wattnode.setFloatValue(WattNode::l12_voltage, _meter.getFloatValue(EM24::l12_voltage));//  # l1-l2 voltage
-    _wattnode.setFloatValue(WattNode::l23_voltage, _meter.getFloatValue(EM24::l23_voltage));//  # l2-l3 voltage
-    _wattnode.setFloatValue(WattNode::l31_voltage, _meter.getFloatValue(EM24::l31_voltage));//  # l3-l1 voltage
-    _wattnode.setFloatValue(WattNode::frequency, _meter.getFloatValue(EM24::frequency));//  # line frequency    
+    _wattnode.setFloatValue<WattNode::energy_active>(_snapshot.getFloatValue<EM24::import_energy_active>()+_snapshot.getFloatValue<EM24::export_energy_active>());// # total active energy
+    _wattnode.setFloatValue<WattNode::import_energy_active>(_snapshot.getFloatValue<EM24::import_energy_active>());//  # imported active energy
+    _wattnode.setFloatValue<WattNode::energy_active_nr>(_snapshot.getFloatValue<EM24::import_energy_active>()+_snapshot.getFloatValue<EM24::export_energy_active>());//  # total active energy non-reset
+    _wattnode.setFloatValue<WattNode::import_energy_active_nr>(_snapshot.getFloatValue<EM24::import_energy_active>());//  # imported active energy non-reset
+    _wattnode.setFloatValue<WattNode::power_active>(_snapshot.getFloatValue<EM24::power_active>());//  # total power
+    _wattnode.setFloatValue<WattNode::l1_power_active>(_snapshot.getFloatValue<EM24::l1_power_active>());
+    _wattnode.setFloatValue<WattNode::l2_power_active>(_snapshot.getFloatValue<EM24::l2_power_active>());
+    _wattnode.setFloatValue<WattNode::l3_power_active>(_snapshot.getFloatValue<EM24::l3_power_active>());
+    _wattnode.setFloatValue<WattNode::voltage_ln>(_snapshot.getFloatValue<EM24::voltage_ln>());//  # l-n voltage
+    _wattnode.setFloatValue<WattNode::l1n_voltage>(_snapshot.getFloatValue<EM24::l1_voltage>());//  # l1-n voltage
+    _wattnode.setFloatValue<WattNode::l2n_voltage>(_snapshot.getFloatValue<EM24::l2_voltage>());//  # l2-n voltage
+    _wattnode.setFloatValue<WattNode::l3n_voltage>(_snapshot.getFloatValue<EM24::l3_voltage>());//  # l3-n voltage
+    _wattnode.setFloatValue<WattNode::voltage_ll>(_snapshot.getFloatValue<EM24::voltage_ll>());//  # l-l voltage
+    _wattnode.setFloatValue<WattNode::l12_voltage>(_snapshot.getFloatValue<EM24::l12_voltage>());//  # l1-l2 voltage
+    _wattnode.setFloatValue<WattNode::l23_voltage>(_snapshot.getFloatValue<EM24::l23_voltage>());//  # l2-l3 voltage
+    _wattnode.setFloatValue<WattNode::l31_voltage>(_snapshot.getFloatValue<EM24::l31_voltage>());//  # l3-l1 voltage
+    _wattnode.setFloatValue<WattNode::frequency>(_snapshot.getFloatValue<EM24::frequency>());//  # line frequency    
     
     // Block 1100
-    _wattnode.setFloatValue(WattNode::l1_energy_active, _meter.getFloatValue(EM24::l1_import_energy_active)+_meter.getFloatValue(EM24::export_energy_active)/3); //  total active energy l1
-    _wattnode.setFloatValue(WattNode::l2_energy_active, _meter.getFloatValue(EM24::l2_import_energy_active)+_meter.getFloatValue(EM24::export_energy_active)/3); //  total active energy l2
-    _wattnode.setFloatValue(WattNode::l3_energy_active, _meter.getFloatValue(EM24::l3_import_energy_active)+_meter.getFloatValue(EM24::export_energy_active)/3); //  total active energy l3
-    _wattnode.setFloatValue(WattNode::l1_import_energy_active, _meter.getFloatValue(EM24::l1_import_energy_active)); //  imported active energy l1
-    _wattnode.setFloatValue(WattNode::l2_import_energy_active, _meter.getFloatValue(EM24::l2_import_energy_active)); //  imported active energy l2
-    _wattnode.setFloatValue(WattNode::l3_import_energy_active, _meter.getFloatValue(EM24::l3_import_energy_active)); //  imported active energy l3
-    _wattnode.setFloatValue(WattNode::export_energy_active, _meter.getFloatValue(EM24::export_energy_active)); //  total exported active energy
-    _wattnode.setFloatValue(WattNode::export_energy_active_nr, _meter.getFloatValue(EM24::export_energy_active)); //  total exported active energy non-reset
-    _wattnode.setFloatValue(WattNode::l1_export_energy_active, _meter.getFloatValue(EM24::export_energy_active)/3); //  exported energy l1
-    _wattnode.setFloatValue(WattNode::l2_export_energy_active, _meter.getFloatValue(EM24::export_energy_active)/3); //  exported energy l2
-    _wattnode.setFloatValue(WattNode::l3_export_energy_active, _meter.getFloatValue(EM24::export_energy_active)/3); //  exported energy l3
-    _wattnode.setFloatValue(WattNode::energy_reactive, _meter.getFloatValue(EM24::import_energy_reactive) + _meter.getFloatValue(EM24::export_energy_reactive)); //  total reactive energy
-    //_wattnode.setFloatValue(WattNode::l1_energy_reactive, _meter.getFloatValue(EM24::l1_energy_reactive)); //  reactive energy l1
-    //_wattnode.setFloatValue(WattNode::l2_energy_reactive, _meter.getFloatValue(EM24::l2_energy_reactive)); //  reactive energy l2
-    //_wattnode.setFloatValue(WattNode::l3_energy_reactive, _meter.getFloatValue(EM24::l3_energy_reactive)); //  reactive energy l3
-    //_wattnode.setFloatValue(WattNode::energy_apparent, _meter.getFloatValue(EM24::energy_apparent)); //  total apparent energy
-    //_wattnode.setFloatValue(WattNode::l1_energy_apparent, _meter.getFloatValue(EM24::l1_energy_apparent)); //  apparent energy l1
-    //_wattnode.setFloatValue(WattNode::l2_energy_apparent, _meter.getFloatValue(EM24::l2_energy_apparent)); //  apparent energy l2
-    //_wattnode.setFloatValue(WattNode::l3_energy_apparent, _meter.getFloatValue(EM24::l3_energy_apparent)); //  apparent energy l3
-    _wattnode.setFloatValue(WattNode::power_factor, _meter.getFloatValue(EM24::total_pf)); //  power factor
-    _wattnode.setFloatValue(WattNode::l1_power_factor, _meter.getFloatValue(EM24::l1_power_factor)); //  power factor l1
-    _wattnode.setFloatValue(WattNode::l2_power_factor, _meter.getFloatValue(EM24::l2_power_factor)); //  power factor l2
-    _wattnode.setFloatValue(WattNode::l3_power_factor, _meter.getFloatValue(EM24::l3_power_factor)); //  power factor l3
-    _wattnode.setFloatValue(WattNode::power_reactive, _meter.getFloatValue(EM24::power_reactive)); //  total reactive power
-    _wattnode.setFloatValue(WattNode::l1_power_reactive, _meter.getFloatValue(EM24::l1_power_reactive)); //  reactive power l1
-    _wattnode.setFloatValue(WattNode::l2_power_reactive, _meter.getFloatValue(EM24::l2_power_reactive)); //  reactive power l2
-    _wattnode.setFloatValue(WattNode::l3_power_reactive, _meter.getFloatValue(EM24::l3_power_reactive)); //  reactive power l3
-    _wattnode.setFloatValue(WattNode::power_apparent, _meter.getFloatValue(EM24::power_apparent)); //  total apparent power
-    _wattnode.setFloatValue(WattNode::l1_power_apparent, _meter.getFloatValue(EM24::l1_power_apparent)); //  apparent power l1
-    _wattnode.setFloatValue(WattNode::l2_power_apparent, _meter.getFloatValue(EM24::l2_power_apparent)); //  apparent power l2
-    _wattnode.setFloatValue(WattNode::l3_power_apparent, _meter.getFloatValue(EM24::l3_power_apparent)); //  apparent power l3
-    _wattnode.setFloatValue(WattNode::l1_current, _meter.getFloatValue(EM24::l1_current)); //  current l1
-    _wattnode.setFloatValue(WattNode::l2_current, _meter.getFloatValue(EM24::l2_current)); //  current l2
-    _wattnode.setFloatValue(WattNode::l3_current, _meter.getFloatValue(EM24::l3_current)); //  current l3
-    _wattnode.setFloatValue(WattNode::demand_power_active, _meter.getFloatValue(EM24::demand_power_active)); //  demand power
-    //_wattnode.setFloatValue(WattNode::minimum_demand_power_active, _meter.getFloatValue(EM24::minimum_demand_power_active)); //  minimum demand power
-    _wattnode.setFloatValue(WattNode::maximum_demand_power_active, _meter.getFloatValue(EM24::maximum_demand_power_active)); //  maximum demand power
-    _wattnode.setFloatValue(WattNode::demand_power_apparent, _meter.getFloatValue(EM24::demand_power_apparent)); //  apparent demand power
-    //_wattnode.setFloatValue(WattNode::l1_demand_power_active, _meter.getFloatValue(EM24::l1_demand_power_active)); //  demand power l1
-    //_wattnode.setFloatValue(WattNode::l2_demand_power_active, _meter.getFloatValue(EM24::l2_demand_power_active)); //  demand power l2
-    //_wattnode.setFloatValue(WattNode::l3_demand_power_active, _meter.getFloatValue(EM24::l3_demand_power_active)); //  demand power l3
+    _wattnode.setFloatValue<WattNode::l1_energy_active>(_snapshot.getFloatValue<EM24::l1_import_energy_active>()+_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  total active energy l1
+    _wattnode.setFloatValue<WattNode::l2_energy_active>(_snapshot.getFloatValue<EM24::l2_import_energy_active>()+_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  total active energy l2
+    _wattnode.setFloatValue<WattNode::l3_energy_active>(_snapshot.getFloatValue<EM24::l3_import_energy_active>()+_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  total active energy l3
+    _wattnode.setFloatValue<WattNode::l1_import_energy_active>(_snapshot.getFloatValue<EM24::l1_import_energy_active>()); //  imported active energy l1
+    _wattnode.setFloatValue<WattNode::l2_import_energy_active>(_snapshot.getFloatValue<EM24::l2_import_energy_active>()); //  imported active energy l2
+    _wattnode.setFloatValue<WattNode::l3_import_energy_active>(_snapshot.getFloatValue<EM24::l3_import_energy_active>()); //  imported active energy l3
+    _wattnode.setFloatValue<WattNode::export_energy_active>(_snapshot.getFloatValue<EM24::export_energy_active>()); //  total exported active energy
+    _wattnode.setFloatValue<WattNode::export_energy_active_nr>(_snapshot.getFloatValue<EM24::export_energy_active>()); //  total exported active energy non-reset
+    _wattnode.setFloatValue<WattNode::l1_export_energy_active>(_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  exported energy l1
+    _wattnode.setFloatValue<WattNode::l2_export_energy_active>(_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  exported energy l2
+    _wattnode.setFloatValue<WattNode::l3_export_energy_active>(_snapshot.getFloatValue<EM24::export_energy_active>()/3); //  exported energy l3
+    _wattnode.setFloatValue<WattNode::energy_reactive>(_snapshot.getFloatValue<EM24::import_energy_reactive>() + _snapshot.getFloatValue<EM24::export_energy_reactive>()); //  total reactive energy
+    //_wattnode.setFloatValue<WattNode::l1_energy_reactive>(_snapshot.getFloatValue<EM24::l1_energy_reactive>()); //  reactive energy l1
+    //_wattnode.setFloatValue<WattNode::l2_energy_reactive>(_snapshot.getFloatValue<EM24::l2_energy_reactive>()); //  reactive energy l2
+    //_wattnode.setFloatValue<WattNode::l3_energy_reactive>(_snapshot.getFloatValue<EM24::l3_energy_reactive>()); //  reactive energy l3
+    //_wattnode.setFloatValue<WattNode::energy_apparent>(_snapshot.getFloatValue<EM24::energy_apparent>()); //  total apparent energy
+    //_wattnode.setFloatValue<WattNode::l1_energy_apparent>(_snapshot.getFloatValue<EM24::l1_energy_apparent>()); //  apparent energy l1
+    //_wattnode.setFloatValue<WattNode::l2_energy_apparent>(_snapshot.getFloatValue<EM24::l2_energy_apparent>()); //  apparent energy l2
+    //_wattnode.setFloatValue<WattNode::l3_energy_apparent>(_snapshot.getFloatValue<EM24::l3_energy_apparent>()); //  apparent energy l3
+    _wattnode.setFloatValue<WattNode::power_factor>(_snapshot.getFloatValue<EM24::total_pf>()); //  power factor
+    _wattnode.setFloatValue<WattNode::l1_power_factor>(_snapshot.getFloatValue<EM24::l1_power_factor>()); //  power factor l1
+    _wattnode.setFloatValue<WattNode::l2_power_factor>(_snapshot.getFloatValue<EM24::l2_power_factor>()); //  power factor l2
+    _wattnode.setFloatValue<WattNode::l3_power_factor>(_snapshot.getFloatValue<EM24::l3_power_factor>()); //  power factor l3
+    _wattnode.setFloatValue<WattNode::power_reactive>(_snapshot.getFloatValue<EM24::power_reactive>()); //  total reactive power
+    _wattnode.setFloatValue<WattNode::l1_power_reactive>(_snapshot.getFloatValue<EM24::l1_power_reactive>()); //  reactive power l1
+    _wattnode.setFloatValue<WattNode::l2_power_reactive>(_snapshot.getFloatValue<EM24::l2_power_reactive>()); //  reactive power l2
+    _wattnode.setFloatValue<WattNode::l3_power_reactive>(_snapshot.getFloatValue<EM24::l3_power_reactive>()); //  reactive power l3
+    _wattnode.setFloatValue<WattNode::power_apparent>(_snapshot.getFloatValue<EM24::power_apparent>()); //  total apparent power
+    _wattnode.setFloatValue<WattNode::l1_power_apparent>(_snapshot.getFloatValue<EM24::l1_power_apparent>()); //  apparent power l1
+    _wattnode.setFloatValue<WattNode::l2_power_apparent>(_snapshot.getFloatValue<EM24::l2_power_apparent>()); //  apparent power l2
+    _wattnode.setFloatValue<WattNode::l3_power_apparent>(_snapshot.getFloatValue<EM24::l3_power_apparent>()); //  apparent power l3
+    _wattnode.setFloatValue<WattNode::l1_current>(_snapshot.getFloatValue<EM24::l1_current>()); //  current l1
+    _wattnode.setFloatValue<WattNode::l2_current>(_snapshot.getFloatValue<EM24::l2_current>()); //  current l2
+    _wattnode.setFloatValue<WattNode::l3_current>(_snapshot.getFloatValue<EM24::l3_current>()); //  current l3
+    _wattnode.setFloatValue<WattNode::demand_power_active>(_snapshot.getFloatValue<EM24::demand_power_active>()); //  demand power
+    //_wattnode.setFloatValue<WattNode::minimum_demand_power_active>(_snapshot.getFloatValue<EM24::minimum_demand_power_active>()); //  minimum demand power
+    _wattnode.setFloatValue<WattNode::maximum_demand_power_active>(_snapshot.getFloatValue<EM24::maximum_demand_power_active>()); //  maximum demand power
+    _wattnode.setFloatValue<WattNode::demand_power_apparent>(_snapshot.getFloatValue<EM24::demand_power_apparent>()); //  apparent demand power
+    //_wattnode.setFloatValue<WattNode::l1_demand_power_active>(_snapshot.getFloatValue<EM24::l1_demand_power_active>()); //  demand power l1
+    //_wattnode.setFloatValue<WattNode::l2_demand_power_active>(_snapshot.getFloatValue<EM24::l2_demand_power_active>()); //  demand power l2
+    //_wattnode.setFloatValue<WattNode::l3_demand_power_active>(_snapshot.getFloatValue<EM24::l3_demand_power_active>()); //  demand power l3
+
+    // The inverter sees all values of this conversion at once
+    _wattnode.publish();
+
+    _allocations = allocationCount() - allocations;
+
+    // The instantaneous values served are as old as the oldest dynamic block of the meters
+    unsigned long sampled = 0;
+    for (uint8_t m = 0; m < _meter.size(); m++)
+    {
+        const BlockTiming &t = _meter[m]._scheduler.timing(EM24::dynamic);
+        if (t._completed > 0 && (m == 0 || (long)(t._lastCompleted - sampled) < 0))
+            sampled = t._lastCompleted;
+    }
+    _wattnode._demand.sampled(WattNode::block1000, sampled);
+    _wattnode._demand.sampled(WattNode::block1100, sampled);
+}
+
+void modbus::ConvertEM24ToWattNode::ScheduleFromDemand(unsigned long now)
+{
+    _wattnode.takeReads();
+    // Keep the fixed schedule until the inverter starts reading
+    if (!_wattnode._demand.any())
+        return;
+
+    // Fastest read interval over the WattNode blocks that are read, per EM24 block. 0 if none of them is read
+    unsigned long interval[EM24::last_block] = {0};
+    for (uint16_t w = 0; w < WattNode::last_block; w++)
+    {
+        if (!_wattnode._demand.active(w, now))
+            continue;
+        // A block read only once has no interval yet, take 1 second
+        unsigned long i = _wattnode._demand.demand(w)._interval;
+        if (i == 0)
+            i = 1000;
+        for (uint16_t e = 0; e < EM24::last_block; e++)
+        {
+            if ((_sources[w] & (1u << e)) && (interval[e] == 0 || i < interval[e]))
+                interval[e] = i;
+        }
+    }
+
+    // The inverter asks for the instantaneous values (1010) at a steady rate. Read the dynamic block once per
+    // inverter read, released so that it arrives just before the next read is expected, instead of at a phase
+    // unrelated to the inverter. The schedule is locked again on every read, to follow drift.
+    const BlockDemand &inverter = _wattnode._demand.demand(WattNode::block1000);
+    bool locked = _wattnode._demand.active(WattNode::block1000, now) && inverter._interval > 0;
+    if (locked && inverter._reads != _phaseReads)
+    {
+        _phaseReads = inverter._reads;
+        for (uint8_t m = 0; m < _meter.size(); m++)
+        {
+            unsigned long lead = std::min(_meter[m]._responseTime + 2 * inverter._deviation + _phaseMargin, inverter._interval);
+            _meter[m]._scheduler.releaseAt(EM24::dynamic, inverter._lastRead + inverter._interval - lead,
+                                            std::min(inverter._interval, (unsigned long)UINT16_MAX));
+        }
+    }
+
+    // Refresh twice per read interval, but not faster than the schedule of the EM24.
+    // The period is rounded to a multiple of the scheduled period, so blocks keep being released together and
+    // read in one request, instead of drifting apart with the measured interval.
+    for (uint8_t m = 0; m < _meter.size(); m++)
+    {
+        Scheduler<EM24> &scheduler = _meter[m]._scheduler;
+        for (uint16_t e = 0; e < EM24::last_block; e++)
+        {
+            if (locked && e == EM24::dynamic)
+                continue;
+            unsigned long period = 0;
+            unsigned long base = scheduler.basePeriod(e);
+            if (interval[e] > 0 && base > 0)
+                period = std::max((interval[e] / 2 + base / 2) / base, 1ul) * base;
+            else if (interval[e] > 0)
+                period = interval[e] / 2;
+            period = std::min(period, (unsigned long)UINT16_MAX);
+            if (period != scheduler.period(e) || scheduler.pinned(e))
+                scheduler.setPeriod(e, period, now);
+        }
+    }
 }
@@ -13,20 +13,49 @@
 #include "wattnode.h"
 #include "slave.h"
 #include "master.h"
+#include "meter_aggregate.h"
 namespace modbus
 {
     class ConvertEM24ToWattNode {
     public:
 
-        ConvertEM24ToWattNode(modbus::Master<EM24>& meter, modbus::Slave<WattNode>& wattnode)
+        ConvertEM24ToWattNode(modbus::MeterAggregate<EM24>& meter, modbus::Slave<WattNode>& wattnode)
         : _meter(meter)
         , _wattnode(wattnode)
         {}
 
         void CopyDataFromMasterToSlave();
 
+        // Poll only the EM24 blocks that feed WattNode blocks the inverter reads, at about twice the rate it reads them.
+        // The instantaneous values are instead read once per inverter read, timed to arrive just before it.
+        // First takes the reads of the inverter the slave queued since the previous call.
+        void ScheduleFromDemand(unsigned long now);
+
+        // Time the instantaneous values should arrive before the expected inverter read, on top of the response time of
+        // the meter and twice the deviation of the inverter read interval. Covers the loop delay.
+        unsigned long _phaseMargin = 50;
+
+        // Heap allocations done by the last CopyDataFromMasterToSlave, see alloc_counter.h. Expected to be 0.
+        uint32_t _allocations = 0;
+
     private:       
-        modbus::Master<EM24>&    _meter;
+        // The EM24 blocks each WattNode block is converted from. Keep in line with CopyDataFromMasterToSlave
+        static constexpr uint32_t _sources[WattNode::last_block] = {
+            0,                                                                         // block0000
+            (1u << EM24::dynamic) | (1u << EM24::energy),                              // block1000
+            (1u << EM24::dynamic) | (1u << EM24::energy) | (1u << EM24::tariff),       // block1100
+            0,                                                                         // block1600
+            0,                                                                         // block1650
+            0,                                                                         // block1700
+            0,                                                                         // block1736
+            0,                                                                         // block2127
+        };
+        static_assert(WattNode::last_block == 8, "Update _sources when adding WattNode blocks");
+        // Reads of block1000 that the dynamic block was phase locked to
+        uint32_t _phaseReads = 0;
+        // The values CopyDataFromMasterToSlave converts, a member to keep it off the stack of the meter task
+        modbus::MeterAggregate<EM24>::Snapshot _snapshot;
+        modbus::MeterAggregate<EM24>& _meter;
         modbus::Slave<WattNode>& _wattnode;
     };
 }
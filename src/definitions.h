@@ -9,6 +9,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include <atomic>
 #include <vector>
 
 namespace modbus
@@ -29,7 +30,7 @@ namespace modbus
         hundred = 100,
         thousand = 1000
     };
-    static uint16_t getScaling(Scaling s)
+    static constexpr uint16_t getScaling(Scaling s)
     {
         switch (s)
         {
@@ -44,7 +45,7 @@ namespace modbus
         }
         return 0;
     }
-    static uint16_t getLogScaling(Scaling s)
+    static constexpr uint16_t getLogScaling(Scaling s)
     {
         switch (s)
         {
@@ -59,7 +60,7 @@ namespace modbus
         }
         return 0;
     }
-    static uint16_t numberRegisters(DataType d)
+    static constexpr uint16_t numberRegisters(DataType d)
     {
         switch (d)
         {
@@ -78,36 +79,12 @@ namespace modbus
     }
     union Value
     {
-        static Value _uint32_t(uint32_t v)
-        {
-            Value r;
-            r.ui32 = v;
-            return r;
-        }
-        static Value _int32_t(int32_t v)
-        {
-            Value r;
-            r.i32 = v;
-            return r;
-        }
-        static Value _int16_t(int16_t v)
-        {
-            Value r;
-            r.i16 = v;
-            return r;
-        }
-        static Value _uint16_t(uint16_t v)
-        {
-            Value r;
-            r.ui16 = v;
-            return r;
-        }
-        static Value _float32_t(float v)
-        {
-            Value r;
-            r.f32 = v;
-            return r;
-        }
+        constexpr Value() : ui32(0) {}
+        static constexpr Value _uint32_t(uint32_t v) { return Value(v); }
+        static constexpr Value _int32_t(int32_t v) { return Value(v); }
+        static constexpr Value _int16_t(int16_t v) { return Value(v); }
+        static constexpr Value _uint16_t(uint16_t v) { return Value(v); }
+        static constexpr Value _float32_t(float v) { return Value(v); }
         struct
         {
             uint8_t b1;
@@ -120,58 +97,217 @@ namespace modbus
             uint16_t w1;
             uint16_t w2;
         };
-        struct
-        {
-            uint16_t w;
-        };
-        struct
-        {
-            float f32;
-        };
-        struct
+        uint16_t w;
+        float f32;
+        uint16_t ui16;
+        int16_t i16;
+        uint32_t ui32;
+        int32_t i32;
+
+    private:
+        // Typed constructors allow the register tables to be constant initialized and placed in flash
+        constexpr explicit Value(uint32_t v) : ui32(v) {}
+        constexpr explicit Value(int32_t v) : i32(v) {}
+        constexpr explicit Value(uint16_t v) : ui16(v) {}
+        constexpr explicit Value(int16_t v) : i16(v) {}
+        constexpr explicit Value(float v) : f32(v) {}
+    };
+
+    // Span. Read only view on a statically allocated array, so tables can be iterated without copying them
+    template <typename T>
+    struct Span
+    {
+        constexpr const T *begin() const { return _data; }
+        constexpr const T *end() const { return _data + _size; }
+        constexpr uint16_t size() const { return _size; }
+        constexpr const T &operator[](uint16_t i) const { return _data[i]; }
+
+        const T *_data;
+        uint16_t _size;
+    };
+
+    // Order of the 16 bit words of 32 bit values
+    enum WordOrder
+    {
+        lsw_first,
+        msw_first
+    };
+
+    // Decoder. Converts the raw registers of a value into a scaled float.
+    // One instance exists per DataType, Scaling and WordOrder combination, so the conversion is straight-line code
+    // and the selection is done once when the device description is built.
+    using Decoder = float (*)(const uint16_t *r);
+
+    template <WordOrder W>
+    inline uint32_t join(const uint16_t *r)
+    {
+        if constexpr (W == lsw_first)
+            return (uint32_t(r[1]) << 16) | r[0];
+        return (uint32_t(r[0]) << 16) | r[1];
+    }
+    // Unscaled value of the raw registers
+    template <DataType D, WordOrder W>
+    inline float toFloat(const uint16_t *r)
+    {
+        if constexpr (D == float32)
         {
-            uint16_t ui16;
-        };
-        struct
+            Value v;
+            v.ui32 = join<W>(r);
+            return v.f32;
+        }
+        else if constexpr (D == int16)
+            return float(int16_t(r[0]));
+        else if constexpr (D == uint16)
+            return float(r[0]);
+        else if constexpr (D == int32)
+            return float(int32_t(join<W>(r)));
+        else
+            return float(join<W>(r));
+    }
+    template <DataType D, Scaling S, WordOrder W>
+    float decode(const uint16_t *r)
+    {
+        if constexpr (S != none)
+            return toFloat<D, W>(r) * (1.0f / float(S));
+        return toFloat<D, W>(r);
+    }
+    // Decode a run of consecutive values of the same type. Kept free of aliasing and branches so the loop vectorizes.
+    template <DataType D, WordOrder W>
+    void decodeRun(const uint16_t *__restrict r, const float *__restrict factor, float *__restrict o, size_t n)
+    {
+        constexpr size_t words = numberRegisters(D);
+        for (size_t i = 0; i < n; i++)
+            o[i] = toFloat<D, W>(r + i * words) * factor[i];
+    }
+    template <DataType D, WordOrder W>
+    constexpr Decoder getDecoder(Scaling s)
+    {
+        switch (s)
         {
-            int16_t i16;
-        };
-        struct
+        case none:
+            return &decode<D, none, W>;
+        case ten:
+            return &decode<D, ten, W>;
+        case hundred:
+            return &decode<D, hundred, W>;
+        case thousand:
+            return &decode<D, thousand, W>;
+        }
+        return nullptr;
+    }
+    template <WordOrder W>
+    constexpr Decoder getDecoder(DataType d, Scaling s)
+    {
+        switch (d)
         {
-            uint32_t ui32;
-        };
-        struct
+        case float32:
+            return getDecoder<float32, W>(s);
+        case int16:
+            return getDecoder<int16, W>(s);
+        case uint16:
+            return getDecoder<uint16, W>(s);
+        case int32:
+            return getDecoder<int32, W>(s);
+        case uint32:
+            return getDecoder<uint32, W>(s);
+        }
+        return nullptr;
+    }
+    static constexpr Decoder getDecoder(DataType d, Scaling s, WordOrder w)
+    {
+        return w == lsw_first ? getDecoder<lsw_first>(d, s) : getDecoder<msw_first>(d, s);
+    }
+
+    // Decoder ids. A decoder is identified by a one byte id, an index in the decoder table
+    static constexpr uint8_t number_decoders = 2 * 5 * 4;
+    static constexpr uint8_t getDecoderId(DataType d, Scaling s, WordOrder w)
+    {
+        return uint8_t((w * 5 + d) * 4 + getLogScaling(s));
+    }
+    struct DecoderTable
+    {
+        constexpr DecoderTable() : _decoders()
         {
-            int32_t i32;
-        };
+            const DataType types[] = {float32, int16, uint16, int32, uint32};
+            const Scaling scalings[] = {none, ten, hundred, thousand};
+            for (WordOrder w : {lsw_first, msw_first})
+                for (DataType d : types)
+                    for (Scaling s : scalings)
+                        _decoders[getDecoderId(d, s, w)] = getDecoder(d, s, w);
+        }
+        Decoder _decoders[number_decoders];
     };
+    inline constexpr DecoderTable decoderTable;
+    static constexpr Decoder getDecoder(uint8_t id)
+    {
+        return decoderTable._decoders[id];
+    }
 
-    // RegisterReference. Avoid searching by string and instead use indexing
+    // RegisterReference. Avoid searching by string and instead use indexing.
+    // Compact handle resolved at compile time from the e_registers enum, see DeviceDescription::getRegisterReference.
     struct RegisterReference
     {
-        String  _desc;
-        int32_t _block_idx;
-        int32_t _register_idx;
+        uint8_t _block_idx = 0;
+        uint8_t _register_idx = 0; // Index of the register in the block, and of its value in the decoded snapshot
+        uint16_t _word = 0;        // Offset of the first word of the register relative to the start of the block
+        uint8_t _decoder = 0;      // Decoder id
     };
 
     // Register and Block Defintion
+    // Registers are listed in the order of e_registers, a block refers to the first and last register it contains
     template <typename MODBUS_TYPE>
     struct RegisterDefinition
     {
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        const RegisterType _register;
-        const DataType     _dataType;
-        const String       _desc;
-        const String       _unit;
-        const Scaling      _scaling;
-        const Value        _default;
+        RegisterType _register;
+        DataType _dataType;
+        const char *_desc;
+        const char *_unit;
+        Scaling _scaling;
+        Value _default;
     };
     template <typename MODBUS_TYPE>
     struct BlockDefinition
     {
-        const String   _name;
-        const uint16_t _offset;
-        const std::vector<RegisterDefinition<MODBUS_TYPE>> _rd;
+        using RegisterType = typename MODBUS_TYPE::e_registers;
+        const char *_name;
+        uint16_t _offset;
+        RegisterType _first;
+        RegisterType _last;
+    };
+    // BlockSchedule. How often a block is read (period in ms) and how urgent it is when several are due
+    // (priority, 0 is most urgent). A period of 0 means the block is only read on request.
+    template <typename MODBUS_TYPE>
+    struct BlockSchedule
+    {
+        using BlockType = typename MODBUS_TYPE::e_blocks;
+        BlockType _block;
+        uint16_t _period;
+        uint8_t _priority;
+    };
+
+    // How a register is formed when several meters are combined into one, see MeterAggregate
+    //   sum           summed over the meters, each with its sign
+    //   first         taken from the first meter
+    //   apparent      sqrt(P^2 + Q^2) of the combined active power P and reactive power Q
+    //   power_factor  P / S of the combined active power and apparent power
+    enum class Combination
+    {
+        sum,
+        first,
+        apparent,
+        power_factor
+    };
+    // RegisterCombination. A register that is not combined the way its unit implies. Apparent power and power factor
+    // are derived from the _active and _reactive registers.
+    template <typename MODBUS_TYPE>
+    struct RegisterCombination
+    {
+        using RegisterType = typename MODBUS_TYPE::e_registers;
+        RegisterType _register;
+        Combination _combination;
+        RegisterType _active;
+        RegisterType _reactive;
     };
 
     class Register
@@ -228,52 +364,29 @@ namespace modbus
 
             return result;
         }
+        // Scaled value of the register, using the decoder selected for this register
         float toFloat32(const uint16_t *r) const
         {
-            float result = 0;
-            Value v;
-            switch (_dataType)
-            {
-            case float32:
-                v.w1 = r[0];
-                v.w2 = r[1];
-                result = round(float(v.f32) * getScaling(_scaling)) / getScaling(_scaling);
-                break;
-            case int16:
-                v.w1 = r[0];
-                result = round(float(v.i16) * getScaling(_scaling)) / getScaling(_scaling);
-                break;
-            case uint16:
-                v.w1 = r[0];
-                result = round(float(v.ui16) * getScaling(_scaling)) / getScaling(_scaling);
-                break;
-            case int32:
-                v.w1 = r[0];
-                v.w2 = r[1];
-                result = round(float(v.i32) * getScaling(_scaling)) / getScaling(_scaling);
-                break;
-            case uint32:
-                v.w1 = r[0];
-                v.w2 = r[1];
-                result = round(float(v.ui32) * getScaling(_scaling)) / getScaling(_scaling);
-                break;
-            }
-            return result;
+            return getDecoder(_decoder)(r);
         }
 
-        const uint16_t _offset;
-        const uint8_t _number;
-        const DataType _dataType;
-        const String _desc;
-        const String _unit;
-        const Scaling _scaling;
-        const Value _default;
+        uint16_t _offset = 0;
+        uint8_t _number = 0;
+        DataType _dataType = int16;
+        const char *_desc = "";
+        const char *_unit = "";
+        Scaling _scaling = none;
+        Value _default;
+        WordOrder _wordOrder = lsw_first;
+        uint8_t _decoder = 0;
+
+        constexpr Register() {}
 
     private:
         template <typename MODBUS_TYPE>
         friend class DeviceDescription;
-        Register(uint16_t offset, uint8_t number, DataType r_type, String desc, String unit, Scaling scaling, Value d)
-            : _offset(offset), _number(number), _dataType(r_type), _desc(desc), _unit(unit), _scaling(scaling), _default(d)
+        constexpr Register(uint16_t offset, uint8_t number, DataType r_type, const char *desc, const char *unit, Scaling scaling, Value d, WordOrder wordOrder)
+            : _offset(offset), _number(number), _dataType(r_type), _desc(desc), _unit(unit), _scaling(scaling), _default(d), _wordOrder(wordOrder), _decoder(getDecoderId(r_type, scaling, wordOrder))
         {
         }
     };
@@ -282,42 +395,78 @@ namespace modbus
     class Block
     {
     public:
-        ~Block() {}
+        const char *_name = "";
+        uint16_t _offset = 0;
+        uint16_t _number_reg = 0;
+        uint16_t _first_register = 0;
+        uint16_t _number_registers = 0;
 
-        const String _name;
-        const std::vector<Register> _registers;
-        const uint16_t _offset = 0;
-        const uint16_t _number_reg = 0;
+        constexpr Block() {}
 
     private:
         template <typename MODBUS_TYPE>
         friend class DeviceDescription;
-        Block(const String &name, const std::vector<Register> &registers, uint16_t offset, uint16_t number_reg)
-            : _name(name), _registers(registers), _offset(offset), _number_reg(number_reg)
+        constexpr Block(const char *name, uint16_t offset, uint16_t number_reg, uint16_t first_register, uint16_t number_registers)
+            : _name(name), _offset(offset), _number_reg(number_reg), _first_register(first_register), _number_registers(number_registers)
         {
         }
     };
 
-    // Full description of the blocks and registers of a device, with a check that the registers in a block are contiguous
+    // Full description of the blocks and registers of a device.
+    // It is built at compile time from the register and block definitions, so the tables live in flash and need no heap.
     template <typename MODBUS_TYPE>
     class DeviceDescription
     {
     public:
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        static DeviceDescription makeDD(const char *name, const std::vector<BlockDefinition<MODBUS_TYPE>> &blocks)
+        using BlockType = typename MODBUS_TYPE::e_blocks;
+        static constexpr uint16_t number_registers = RegisterType::last;
+        static constexpr uint16_t number_blocks = BlockType::last_block;
+        // Maximum number of registers a single modbus read request can return
+        static constexpr uint16_t max_block_size = 125;
+        using RegisterDefinitions = RegisterDefinition<MODBUS_TYPE>[number_registers];
+        using BlockDefinitions = BlockDefinition<MODBUS_TYPE>[number_blocks];
+        static_assert(number_blocks <= 256, "RegisterReference stores the block index in one byte");
+
+        constexpr DeviceDescription(const char *name, const RegisterDefinitions &registers, const BlockDefinitions &blocks, WordOrder wordOrder = lsw_first) : _name(name)
+        {
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                uint16_t r_offset = blocks[b]._offset;
+                for (uint16_t i = blocks[b]._first; i <= blocks[b]._last; i++)
+                {
+                    const RegisterDefinition<MODBUS_TYPE> &d = registers[i];
+                    _registers[i] = Register(r_offset, numberRegisters(d._dataType), d._dataType, d._desc, d._unit, d._scaling, d._default, wordOrder);
+                    _rr[i] = RegisterReference{uint8_t(b), uint8_t(i - blocks[b]._first), uint16_t(r_offset - blocks[b]._offset), _registers[i]._decoder};
+                    r_offset += numberRegisters(d._dataType);
+                }
+                _blocks[b] = Block(blocks[b]._name, blocks[b]._offset, r_offset - blocks[b]._offset, blocks[b]._first, blocks[b]._last - blocks[b]._first + 1);
+            }
+        }
+
+        // Check that the registers are listed in e_registers order, that every register belongs to exactly one block,
+        // and that the blocks are ordered by address without overlapping. Intended to be used in a static_assert.
+        static constexpr bool isContiguous(const RegisterDefinitions &registers, const BlockDefinitions &blocks)
         {
-            std::vector<Block> bl;
-            std::vector<RegisterReference> rr;
-            rr.resize(RegisterType::last);
+            for (uint16_t i = 0; i < number_registers; i++)
+                if (registers[i]._register != i)
+                    return false;
 
-            uint16_t blockNbr = 0;
-            for (auto i = blocks.begin(); i < blocks.end(); i++)
+            uint16_t next_register = 0;
+            uint32_t next_offset = 0;
+            for (uint16_t b = 0; b < number_blocks; b++)
             {
-                Block b = makeBlock(i->_name, blockNbr, i->_offset, i->_rd, rr);
-                blockNbr++;
-                bl.push_back(b);
+                if (blocks[b]._first != next_register || blocks[b]._last < blocks[b]._first || blocks[b]._offset < next_offset)
+                    return false;
+                uint16_t number_reg = 0;
+                for (uint16_t i = blocks[b]._first; i <= blocks[b]._last; i++)
+                    number_reg += numberRegisters(registers[i]._dataType);
+                if (number_reg > max_block_size)
+                    return false;
+                next_register = blocks[b]._last + 1;
+                next_offset = uint32_t(blocks[b]._offset) + number_reg;
             }
-            return DeviceDescription(name, bl, rr);
+            return next_register == number_registers;
         }
 
         // Get a description of the device
@@ -325,15 +474,15 @@ namespace modbus
         {
             String result;
             char buf[200];
-            sprintf(buf, "Device: %s\r\n", _name.c_str());
+            sprintf(buf, "Device: %s\r\n", _name);
             result += buf;
-            for (auto i = _blocks.begin(); i < _blocks.end(); i++)
+            for (auto i = blocks().begin(); i < blocks().end(); i++)
             {
-                sprintf(buf, "  Block: %s, offset=0x%04x (%06u), numreg=%i\r\n", i->_name.c_str(), i->_offset, i->_offset, i->_number_reg);
+                sprintf(buf, "  Block: %s, offset=0x%04x (%06u), numreg=%i\r\n", i->_name, i->_offset, i->_offset, i->_number_reg);
                 result += buf;
-                for (auto j = i->_registers.begin(); j < i->_registers.end(); j++)
+                for (auto j = registers(*i).begin(); j < registers(*i).end(); j++)
                 {
-                    sprintf(buf, "    Register 0x%04x (%06u): %s\r\n", j->_offset, j->_offset, j->_desc.c_str());
+                    sprintf(buf, "    Register 0x%04x (%06u): %s\r\n", j->_offset, j->_offset, j->_desc);
                     result += buf;
                 }
                 sprintf(buf, "\r\n");
@@ -342,63 +491,154 @@ namespace modbus
             return result;
         }
 
-        RegisterReference getRegisterReference(RegisterType r) const
+        constexpr const RegisterReference &getRegisterReference(RegisterType r) const
         {
             return _rr[r];
         }
+        constexpr const Register &getRegister(RegisterType r) const
+        {
+            return _registers[r];
+        }
+        constexpr Span<Block> blocks() const
+        {
+            return Span<Block>{_blocks, number_blocks};
+        }
+        constexpr Span<Register> registers(const Block &b) const
+        {
+            return Span<Register>{_registers + b._first_register, b._number_registers};
+        }
+        // Position of the first word of a block when the words of all blocks are laid out one after the other
+        constexpr uint16_t firstWord(uint16_t block) const
+        {
+            uint16_t word = 0;
+            for (uint16_t b = 0; b < block; b++)
+                word += _blocks[b]._number_reg;
+            return word;
+        }
+        constexpr uint16_t numberWords() const
+        {
+            return firstWord(number_blocks);
+        }
 
-        const String _name;
-        const std::vector<Block> _blocks;
-        const std::vector<RegisterReference> _rr;
+        const char *_name;
 
     private:
-        DeviceDescription(const char *name, const std::vector<Block> &blocks, std::vector<RegisterReference> rr) : _blocks(blocks), _name(name), _rr(rr) {}
-        static Block makeBlock(const String &name, uint16_t blockNbr, uint16_t offset, const std::vector<RegisterDefinition<MODBUS_TYPE>> &registers, std::vector<RegisterReference> &rr)
-        {
-            std::vector<Register> rl;
-            int number = 0;
+        Block _blocks[number_blocks];
+        Register _registers[number_registers];
+        RegisterReference _rr[number_registers];
+    };
 
-            uint16_t r_offset = offset;
-            for (auto i = registers.begin(); i < registers.end(); i++)
+    // BlockValues. This contains values for a block.
+    // Next to the raw registers it keeps a snapshot of all values decoded to float, indexed like the registers of the block.
+    // Both are double buffered under a sequence counter, so readers get a consistent block without a lock while
+    // the one writer fills the other buffer. The counter is odd while the writer is busy, buffer (sequence / 2) % 2
+    // is the published one. A reader only has to retry when the writer started on the buffer it was reading, which
+    // takes two updates during one read.
+    struct BlockValues
+    {
+        BlockValues(const Block &block, Span<Register> registers) : _block(block), _registers(registers)
+        {
+            for (uint8_t b = 0; b < 2; b++)
             {
-                rr[int32_t(i->_register)] = RegisterReference{i->_desc, blockNbr, i - registers.begin()};
-                Register r(r_offset, numberRegisters(i->_dataType), i->_dataType, i->_desc, i->_unit, i->_scaling, i->_default);
-                rl.push_back(r);
-                number += numberRegisters(i->_dataType);
-                r_offset += numberRegisters(i->_dataType);
+                _values[b].resize(block._number_reg);
+                _decoded[b].resize(registers.size());
             }
+            _factor.resize(registers.size());
 
-            return Block(name, rl, offset, number);
+            // Group consecutive registers of the same type in runs, each run is decoded with one loop
+            uint16_t word = 0;
+            for (uint16_t i = 0; i < registers.size(); i++)
+            {
+                const Register &r = registers[i];
+                _factor[i] = r._scaling == none ? 1.0f : 1.0f / float(r._scaling);
+                if (_runs.empty() || _runs.back()._dataType != r._dataType || _runs.back()._wordOrder != r._wordOrder)
+                    _runs.push_back({r._dataType, r._wordOrder, i, 0, word});
+                _runs.back()._number++;
+                word += r._number;
+            }
+        }
+        BlockValues(const BlockValues &o)
+            : _block(o._block), _registers(o._registers), _values{o._values[0], o._values[1]}, _decoded{o._decoded[0], o._decoded[1]},
+              _transaction{o._transaction[0], o._transaction[1]}, _sequence(o._sequence.load()), _factor(o._factor), _runs(o._runs)
+        {
         }
-    };
 
-    // BlockValues. This contains values for a block.
-    struct BlockValues
-    {
-        BlockValues(const Block &block, int32_t _number_reg) : _block(block), _transaction(0) { _values.resize(_number_reg); }
+        // Writer side. Store the raw registers of a response in the back buffer, decode them and publish the result
+        void update(const uint16_t *values, uint16_t transaction)
+        {
+            uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+            _sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            uint8_t back = ((sequence >> 1) + 1) & 1;
+            std::copy(values, values + _block._number_reg, _values[back].begin());
+            _transaction[back] = transaction;
+            decode(back);
+            _sequence.store(sequence + 2, std::memory_order_release);
+        }
 
+        // Reader side. A float is read in one access, so a single value needs no retry
+        float getFloatValue(uint16_t register_idx) const
+        {
+            return _decoded[published(_sequence.load(std::memory_order_acquire))][register_idx];
+        }
         bool getFloatValue(const RegisterReference &rr, float &o) const
         {
-            const Register &r = _block._registers[rr._register_idx];
-            o = r.toFloat32(&(_values[r._offset - _block._offset])) / getScaling(r._scaling);
+            o = getFloatValue(rr._register_idx);
             return true;
         }
+        // Decode a single value straight from the raw registers
+        float decodeValue(const RegisterReference &rr) const
+        {
+            uint16_t r[2];
+            read([&](uint8_t b)
+                 { std::copy(&_values[b][rr._word], &_values[b][rr._word] + _registers[rr._register_idx]._number, r); });
+            return getDecoder(rr._decoder)(r);
+        }
+        // A consistent copy of the raw registers, returns the transaction they came with
+        uint16_t snapshot(uint16_t *values) const
+        {
+            uint16_t transaction = 0;
+            read([&](uint8_t b)
+                 { std::copy(_values[b].begin(), _values[b].end(), values);
+                   transaction = _transaction[b]; });
+            return transaction;
+        }
+        // A consistent copy of all decoded values, indexed like the registers of the block. False before the first update
+        bool snapshot(float *values) const
+        {
+            uint16_t transaction = 0;
+            read([&](uint8_t b)
+                 { std::copy(_decoded[b].begin(), _decoded[b].end(), values);
+                   transaction = _transaction[b]; });
+            return transaction != 0;
+        }
+        uint16_t transaction() const
+        {
+            return _transaction[published(_sequence.load(std::memory_order_acquire))];
+        }
+        // Number of updates, twice. Changes whenever the block is updated
+        uint32_t sequence() const
+        {
+            return _sequence.load(std::memory_order_acquire);
+        }
         String toString() const
         {
             String result;
             char buf[200] = {0};
+            std::vector<uint16_t> values(_block._number_reg);
+            uint16_t transaction = snapshot(values.data());
 
             // Transaction id
-            sprintf(buf, "TransactionID=%i\r\n", _transaction);
+            sprintf(buf, "TransactionID=%i\r\n", transaction);
             result = result += buf;
-            sprintf(buf, "Block %s\r\n", _block._name.c_str());
+            sprintf(buf, "Block %s\r\n", _block._name);
             result = result += buf;
 
             int d = 0;
-            for (auto i = _block._registers.begin(); i < _block._registers.end(); i++)
+            for (auto i = _registers.begin(); i < _registers.end(); i++)
             {
-                String value = i->toString(&(_values[d]));
-                sprintf(buf, "  %s=%s %s\n", i->_desc.c_str(), value.c_str(), i->_unit);
+                String value = i->toString(&(values[d]));
+                sprintf(buf, "  %s=%s %s\n", i->_desc, value.c_str(), i->_unit);
                 result += buf;
                 d += i->_number;
             }
@@ -406,7 +646,76 @@ namespace modbus
         }
 
         const Block &_block;
-        std::vector<uint16_t> _values;
-        uint16_t _transaction;
+        const Span<Register> _registers;
+
+    private:
+        struct DecodeRun
+        {
+            DataType _dataType;
+            WordOrder _wordOrder;
+            uint16_t _first;
+            uint16_t _number;
+            uint16_t _word;
+        };
+        static uint8_t published(uint32_t sequence)
+        {
+            return (sequence >> 1) & 1;
+        }
+        // Call f with the published buffer until it was not written to meanwhile
+        template <typename F>
+        void read(F f) const
+        {
+            for (;;)
+            {
+                uint32_t sequence = _sequence.load(std::memory_order_acquire);
+                f(published(sequence));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint32_t now = _sequence.load(std::memory_order_relaxed);
+                if (now - sequence <= (sequence & 1 ? 1u : 2u))
+                    return;
+            }
+        }
+        // Decode the complete back buffer into its float snapshot
+        void decode(uint8_t b)
+        {
+            for (auto i = _runs.begin(); i < _runs.end(); i++)
+            {
+                if (i->_wordOrder == lsw_first)
+                    decodeRun<lsw_first>(*i, b);
+                else
+                    decodeRun<msw_first>(*i, b);
+            }
+        }
+        template <WordOrder W>
+        void decodeRun(const DecodeRun &run, uint8_t b)
+        {
+            const uint16_t *r = &_values[b][run._word];
+            const float *f = &_factor[run._first];
+            float *o = &_decoded[b][run._first];
+            switch (run._dataType)
+            {
+            case float32:
+                modbus::decodeRun<float32, W>(r, f, o, run._number);
+                break;
+            case int16:
+                modbus::decodeRun<int16, W>(r, f, o, run._number);
+                break;
+            case uint16:
+                modbus::decodeRun<uint16, W>(r, f, o, run._number);
+                break;
+            case int32:
+                modbus::decodeRun<int32, W>(r, f, o, run._number);
+                break;
+            case uint32:
+                modbus::decodeRun<uint32, W>(r, f, o, run._number);
+                break;
+            }
+        }
+        std::vector<uint16_t> _values[2];
+        std::vector<float> _decoded[2];
+        uint16_t _transaction[2] = {};
+        std::atomic<uint32_t> _sequence{0};
+        std::vector<float> _factor;
+        std::vector<DecodeRun> _runs;
     };
 }
@@ -0,0 +1,127 @@
+/**
+ * @file      demand.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Track which blocks of a slave are read by the client and how often
+ */
+#pragma once
+
+#include <algorithm>
+#include "definitions.h"
+
+namespace modbus
+{
+    // BlockDemand. Number of reads of a block, the time of the last read and the smoothed interval between reads
+    // with its smoothed deviation.
+    // The sample age is the age of the data at the moment it is read, given the time the data was sampled.
+    struct BlockDemand
+    {
+        uint32_t _reads = 0;
+        unsigned long _lastRead = 0;
+        unsigned long _interval = 0;
+        unsigned long _deviation = 0;
+        unsigned long _sampled = 0;
+        uint32_t _aged = 0;
+        unsigned long _sumAge = 0;
+        unsigned long _maxAge = 0;
+    };
+
+    // ReadDemand. Records the read requests of the client per block. A block counts as read while the time since
+    // its last read does not exceed four read intervals, with a minimum of inactive_after ms.
+    template <typename MODBUS_TYPE>
+    class ReadDemand
+    {
+    public:
+        static constexpr uint16_t number_blocks = DeviceDescription<MODBUS_TYPE>::number_blocks;
+
+        ReadDemand(unsigned long inactive_after = 30000) : _inactive_after(inactive_after)
+        {
+        }
+
+        // A read of count registers from offset
+        void record(uint16_t offset, uint16_t count, unsigned long now)
+        {
+            Span<Block> blocks = MODBUS_TYPE::getDeviceDescription().blocks();
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const Block &block = blocks[b];
+                if (offset >= block._offset + block._number_reg || offset + count <= block._offset)
+                    continue;
+                BlockDemand &d = _demand[b];
+                if (d._reads > 0)
+                {
+                    // Exponential moving average over about 8 reads. A read within half an interval of the previous
+                    // one is part of the same poll of the client, e.g. 1010x6 followed by 1000x34, and is not an interval.
+                    unsigned long sample = now - d._lastRead;
+                    if (d._interval == 0)
+                        d._interval = sample;
+                    else if (sample >= d._interval / 2)
+                    {
+                        unsigned long deviation = sample > d._interval ? sample - d._interval : d._interval - sample;
+                        d._deviation = (3 * d._deviation + deviation) / 4;
+                        d._interval = (7 * d._interval + sample) / 8;
+                    }
+                }
+                d._reads++;
+                d._lastRead = now;
+                // The read may be recorded after newer data was converted, which is not what was served
+                if (d._sampled != 0 && (long)(now - d._sampled) >= 0)
+                {
+                    unsigned long age = now - d._sampled;
+                    d._aged++;
+                    d._sumAge += age;
+                    d._maxAge = std::max(d._maxAge, age);
+                }
+            }
+            _any = true;
+        }
+
+        // The data of a block was sampled at the given time
+        void sampled(uint16_t block, unsigned long time)
+        {
+            _demand[block]._sampled = time;
+        }
+
+        // True once the client read any block
+        bool any() const
+        {
+            return _any;
+        }
+        bool active(uint16_t block, unsigned long now) const
+        {
+            const BlockDemand &d = _demand[block];
+            if (d._reads == 0)
+                return false;
+            unsigned long limit = std::max(_inactive_after, 4 * d._interval);
+            return now - d._lastRead <= limit;
+        }
+        const BlockDemand &demand(uint16_t block) const
+        {
+            return _demand[block];
+        }
+
+        String toString(unsigned long now) const
+        {
+            String result;
+            char buf[200];
+            Span<Block> blocks = MODBUS_TYPE::getDeviceDescription().blocks();
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const BlockDemand &d = _demand[b];
+                sprintf(buf, "Block %s: reads=%u, interval=%lu ms (+/-%lu), last read %lu ms ago, sample age mean=%lu ms max=%lu ms%s\r\n", blocks[b]._name, d._reads,
+                        d._interval, d._deviation, d._reads > 0 ? now - d._lastRead : 0, d._aged > 0 ? d._sumAge / d._aged : 0, d._maxAge,
+                        active(b, now) ? "" : " (inactive)");
+                result += buf;
+            }
+            return result;
+        }
+
+        unsigned long _inactive_after;
+
+    private:
+        bool _any = false;
+        BlockDemand _demand[number_blocks];
+    };
+}
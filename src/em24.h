@@ -10,15 +10,26 @@
 
 #include <Arduino.h>
 #include <definitions.h>
-#include <vector>
 namespace modbus
 {
     class EM24
     {
     public:
-        static const DeviceDescription<EM24> &getDeviceDescription();
+        static constexpr const DeviceDescription<EM24> &getDeviceDescription();
+        static constexpr Span<BlockSchedule<EM24>> getSchedule();
+        static constexpr Span<RegisterCombination<EM24>> getCombinations();
 
-        // All defined registers. See the definition of each register in the .cpp file
+        // All defined blocks, in the order of the block table
+        enum e_blocks
+        {
+            dynamic,
+            energy,
+            time,
+            tariff,
+            last_block
+        };
+
+        // All defined registers. See the definition of each register in the table below
         enum e_registers
         {
             l1_voltage,
@@ -78,6 +89,115 @@ namespace modbus
             maximum_demand_current,
             last
         };
+
+    private:
+        static const RegisterDefinition<EM24> _registers[];
+        static const BlockDefinition<EM24> _blocks[];
+        static const DeviceDescription<EM24> _dd;
+        static const BlockSchedule<EM24> _schedule[];
+        static const RegisterCombination<EM24> _combinations[];
+    };
+
+    // Protocol for EM24 register list:
+    //   https://www.enika.eu/data/files/produkty/energy%20m/CP/em24%20ethernet%20cp.pdf
+    inline constexpr RegisterDefinition<EM24> EM24::_registers[] = {
+        // dynamic
+        {l1_voltage, DataType::int32, "L1 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l2_voltage, DataType::int32, "L2 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l3_voltage, DataType::int32, "L3 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l12_voltage, DataType::int32, "L1-L2 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l23_voltage, DataType::int32, "L2-L3 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l31_voltage, DataType::int32, "L3-L1 Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {l1_current, DataType::int32, "L1 Current", "A", Scaling::thousand, Value::_int32_t(0)},
+        {l2_current, DataType::int32, "L2 Current", "A", Scaling::thousand, Value::_int32_t(0)},
+        {l3_current, DataType::int32, "L3 Current", "A", Scaling::thousand, Value::_int32_t(0)},
+        {l1_power_active, DataType::int32, "L1 Power (Active)", "W", Scaling::ten, Value::_int32_t(0)},
+        {l2_power_active, DataType::int32, "L2 Power (Active)", "W", Scaling::ten, Value::_int32_t(0)},
+        {l3_power_active, DataType::int32, "L3 Power (Active)", "W", Scaling::ten, Value::_int32_t(0)},
+        {l1_power_apparent, DataType::int32, "L1 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {l2_power_apparent, DataType::int32, "L2 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {l3_power_apparent, DataType::int32, "L3 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {l1_power_reactive, DataType::int32, "L1 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0)},
+        {l2_power_reactive, DataType::int32, "L2 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0)},
+        {l3_power_reactive, DataType::int32, "L3 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0)},
+        {voltage_ln, DataType::int32, "L-N Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {voltage_ll, DataType::int32, "L-L Voltage", "V", Scaling::ten, Value::_int32_t(0)},
+        {power_active, DataType::int32, "Total Power (Active)", "W", Scaling::ten, Value::_int32_t(0)},
+        {power_apparent, DataType::int32, "Total Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {power_reactive, DataType::int32, "Total Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0)},
+        {l1_power_factor, DataType::int16, "L1 Power Factor", "", Scaling::thousand, Value::_int16_t(0)},
+        {l2_power_factor, DataType::int16, "L2 Power Factor", "", Scaling::thousand, Value::_int16_t(0)},
+        {l3_power_factor, DataType::int16, "L3 Power Factor", "", Scaling::thousand, Value::_int16_t(0)},
+        {total_pf, DataType::int16, "Total Power Factor", "", Scaling::thousand, Value::_int16_t(0)},
+        {phase_sequence, DataType::int16, "Phase Sequence", "", Scaling::none, Value::_int16_t(0)},
+        {frequency, DataType::uint16, "Frequency", "Hz", Scaling::ten, Value::_uint16_t(0)},
+        // energy
+        {import_energy_active, DataType::int32, "Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {import_energy_reactive, DataType::int32, "Imported Energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {demand_power_active, DataType::int32, "Demand Power Active", "W", Scaling::ten, Value::_int32_t(0)},
+        {maximum_demand_power_active, DataType::int32, "Maximum Demand Power Active", "W", Scaling::ten, Value::_int32_t(0)},
+        {import_energy_active_partial, DataType::int32, "Partial imported Energy (Active))", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {import_energy_reactive_partial, DataType::int32, "Partial imported Energy (Reactive))", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {l1_import_energy_active, DataType::int32, "L1 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {l2_import_energy_active, DataType::int32, "L2 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {l3_import_energy_active, DataType::int32, "L3 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {t1_import_energy, DataType::int32, "Tarif 1 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {t2_import_energy, DataType::int32, "Tarif 2 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {t3_import_energy, DataType::int32, "Tarif 3 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {t4_import_energy, DataType::int32, "Tarif 4 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {export_energy_active, DataType::int32, "Exported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0)},
+        {export_energy_reactive, DataType::int32, "Exported Energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        // time
+        {hour, DataType::int32, "Hour", "hour", Scaling::hundred, Value::_int32_t(0)},
+        // tariff
+        {t1_import_reactive, DataType::int32, "Tarif 1 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {t2_import_reactive, DataType::int32, "Tarif 2 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {t3_import_reactive, DataType::int32, "Tarif 3 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {t4_import_reactive, DataType::int32, "Tarif 4 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0)},
+        {demand_power_apparent, DataType::int32, "Demand Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {maximum_demand_power_apparent, DataType::int32, "Maximum Demand Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0)},
+        {maximum_demand_current, DataType::int32, "Maximum Demand current (Active)", "A", Scaling::thousand, Value::_int32_t(0)},
+    };
+    inline constexpr BlockDefinition<EM24> EM24::_blocks[] = {
+        {"dynamic", 0x0000, l1_voltage, frequency},
+        {"energy", 0x0034, import_energy_active, export_energy_reactive},
+        {"time", 0x005a, hour, hour},
+        {"tariff", 0x006e, t1_import_reactive, maximum_demand_current},
     };
+    inline constexpr DeviceDescription<EM24> EM24::_dd{"em24", _registers, _blocks};
+    // Instantaneous values are updated regularly, energy every second, time and tariff hardly ever change
+    inline constexpr BlockSchedule<EM24> EM24::_schedule[] = {
+        {dynamic, 500, 0},
+        {energy, 1000, 1},
+        {time, 4700, 3},
+        {tariff, 4700, 2},
+    };
+
+    constexpr const DeviceDescription<EM24> &EM24::getDeviceDescription()
+    {
+        static_assert(DeviceDescription<EM24>::isContiguous(EM24::_registers, EM24::_blocks), "EM24 registers must be listed in e_registers order and form contiguous, non overlapping blocks");
+        return _dd;
+    }
+    constexpr Span<BlockSchedule<EM24>> EM24::getSchedule()
+    {
+        return Span<BlockSchedule<EM24>>{_schedule, sizeof(_schedule) / sizeof(_schedule[0])};
+    }
+    // Apparent power and power factor do not add up over meters, they follow from the combined active and reactive
+    // power. A maximum of the sum is not the sum of the maxima of the meters.
+    inline constexpr RegisterCombination<EM24> EM24::_combinations[] = {
+        {l1_power_apparent, Combination::apparent, l1_power_active, l1_power_reactive},
+        {l2_power_apparent, Combination::apparent, l2_power_active, l2_power_reactive},
+        {l3_power_apparent, Combination::apparent, l3_power_active, l3_power_reactive},
+        {power_apparent, Combination::apparent, power_active, power_reactive},
+        {l1_power_factor, Combination::power_factor, l1_power_active, l1_power_reactive},
+        {l2_power_factor, Combination::power_factor, l2_power_active, l2_power_reactive},
+        {l3_power_factor, Combination::power_factor, l3_power_active, l3_power_reactive},
+        {total_pf, Combination::power_factor, power_active, power_reactive},
+        {maximum_demand_power_active, Combination::first, maximum_demand_power_active, maximum_demand_power_active},
+    };
+    constexpr Span<RegisterCombination<EM24>> EM24::getCombinations()
+    {
+        return Span<RegisterCombination<EM24>>{_combinations, sizeof(_combinations) / sizeof(_combinations[0])};
+    }
 
 }
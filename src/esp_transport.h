@@ -0,0 +1,197 @@
+/**
+ * @file      esp_transport.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Transports on the ESP32: Modbus TCP with the modbus-esp8266 library, Modbus RTU on a UART
+ */
+#pragma once
+
+#include "transport.h"
+#include "rtu_server.h"
+#include <algorithm>
+#include <atomic>
+#include <driver/uart.h>
+#include <ModbusTCP.h>
+#include <lwip/sockets.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace modbus
+{
+    // EspTcpClient. ClientTransport on ModbusTCP
+    class EspTcpClient : public ClientTransport
+    {
+    public:
+        // Call once the network is up
+        void begin()
+        {
+            _tcp.client();
+        }
+
+        bool attach(const IPAddress &remote, int fd) override
+        {
+            return _tcp.attach(remote, fd);
+        }
+        bool disconnect(const IPAddress &remote) override
+        {
+            return _tcp.disconnect(remote);
+        }
+        bool isConnected(const IPAddress &remote) override
+        {
+            return _tcp.isConnected(remote);
+        }
+        uint16_t readIreg(const IPAddress &remote, uint16_t offset, uint16_t *values, uint16_t number_reg, cbTransaction cb) override
+        {
+            return _tcp.readIreg(remote, offset, values, number_reg, cb);
+        }
+        void dropTransactions() override
+        {
+            _tcp.dropTransactions();
+        }
+        void task() override
+        {
+            _tcp.task();
+        }
+        int socket(const IPAddress &remote) override
+        {
+            return _tcp.socket(remote);
+        }
+
+    private:
+        // ModbusTCP keeps its connections to itself and has no public way to take a connected socket. This uses the
+        // protected members of ModbusTCPTemplate as of modbus-esp8266 4.1.0, the version pinned in platformio.ini:
+        // tcpclient[] with MODBUSIP_MAX_CLIENTS slots of WiFiClient *, free when nullptr, and getSlave(ip), the slot
+        // of the client connection to ip or -1. From the ESP32 core it uses WiFiClient(int fd), which takes over
+        // the socket, and WiFiClient::fd().
+        // The slots are only ever client connections, ModbusTCP::server() is not called, so the server bit of a
+        // slot that ModbusTCP::connect clears is never set.
+        class Client : public ModbusTCP
+        {
+        public:
+            // What ModbusTCP::connect does, on a socket that is already connected. Set up like WiFiClient::connect
+            // leaves it: blocking, with Nagle off.
+            bool attach(const IPAddress &remote, int fd)
+            {
+                if (getSlave(remote) >= 0)
+                {
+                    ::close(fd);
+                    return true;
+                }
+                for (uint8_t n = 0; n < MODBUSIP_MAX_CLIENTS; n++)
+                {
+                    if (tcpclient[n])
+                        continue;
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    tcpclient[n] = new WiFiClient(fd);
+                    return true;
+                }
+                ::close(fd);
+                return false;
+            }
+            int socket(const IPAddress &remote)
+            {
+                int8_t n = getSlave(remote);
+                return n >= 0 && tcpclient[n] && tcpclient[n]->connected() ? tcpclient[n]->fd() : -1;
+            }
+        };
+        Client _tcp;
+    };
+
+    // EspSerialLink. SerialLink on a UART, RtuServer answers the inverter over it.
+    // The end of a frame is detected by the RX timeout of the UART, set to the interframe time of the bus. The
+    // driver calls back on that timeout only, and the callback notifies the task waiting in wait(), so a request
+    // is answered one interframe time after its last byte, without polling. Modbus RTU frames have no delimiter,
+    // so pattern detection is not used. The framing and parity errors the driver reports are counted, they tell
+    // LineDetector that the settings do not match the bus.
+    class EspSerialLink : public SerialLink
+    {
+    public:
+        // Call with the port opened on the settings
+        void begin(HardwareSerial *port, uart_port_t uart, const LineSettings &settings)
+        {
+            _port = port;
+            _uart = uart;
+            setRxTimeout(settings._baud);
+            port->onReceive([this]()
+                            {
+                TaskHandle_t waiter = _waiter;
+                if (waiter)
+                    xTaskNotifyGive(waiter); },
+                            true);
+            port->onReceiveError([this](hardwareSerial_error_t error)
+                                 {
+                if (error == UART_FRAME_ERROR || error == UART_PARITY_ERROR)
+                    _errors++; });
+        }
+
+        bool configure(const LineSettings &settings) override
+        {
+            if (!_port)
+                return false;
+            _port->updateBaudRate(settings._baud);
+            bool result = uart_set_parity(_uart, parity(settings._parity)) == ESP_OK &&
+                          uart_set_stop_bits(_uart, settings._stopBits == 2 ? UART_STOP_BITS_2 : UART_STOP_BITS_1) == ESP_OK;
+            setRxTimeout(settings._baud);
+            uint8_t discard[64];
+            while (read(discard, sizeof(discard)) > 0)
+                ;
+            return result;
+        }
+        uint32_t errors() const override
+        {
+            return _errors;
+        }
+
+        // Only one task may wait on the link
+        bool wait(uint32_t timeout) override
+        {
+            _waiter = xTaskGetCurrentTaskHandle();
+            return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout)) > 0;
+        }
+        size_t read(uint8_t *data, size_t length) override
+        {
+            int available = _port ? _port->available() : 0;
+            if (available <= 0)
+                return 0;
+            return _port->read(data, std::min(length, size_t(available)));
+        }
+        bool write(const uint8_t *data, size_t length) override
+        {
+            return _port && _port->write(data, length) == length;
+        }
+        const char *name() const override
+        {
+            return "RS485";
+        }
+
+    private:
+        static constexpr uint32_t rx_timeout_max = 100;
+        // The RX timeout counts characters, rounded up from the interframe time
+        void setRxTimeout(uint32_t baud)
+        {
+            uint32_t symbols = (uint64_t(interframeMicros(baud)) * baud + 10999999) / 11000000;
+            _port->setRxTimeout(std::min(symbols, rx_timeout_max));
+        }
+        static uart_parity_t parity(Parity p)
+        {
+            return p == Parity::even ? UART_PARITY_EVEN : p == Parity::odd ? UART_PARITY_ODD
+                                                                          : UART_PARITY_DISABLE;
+        }
+
+        HardwareSerial *_port = nullptr;
+        uart_port_t _uart = UART_NUM_0;
+        volatile TaskHandle_t _waiter = nullptr;
+        std::atomic<uint32_t> _errors{0};
+    };
+
+    // Configuration of HardwareSerial::begin for the settings
+    inline uint32_t serialConfig(const LineSettings &settings)
+    {
+        static const uint32_t configs[2][3] = {{SERIAL_8N1, SERIAL_8E1, SERIAL_8O1}, {SERIAL_8N2, SERIAL_8E2, SERIAL_8O2}};
+        return configs[settings._stopBits == 2][int(settings._parity)];
+    }
+}
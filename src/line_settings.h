@@ -0,0 +1,225 @@
+/**
+ * @file      line_settings.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Speed and framing of the RS-485 bus, and finding them from the frames of the inverter
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace modbus
+{
+    enum class Parity : uint8_t
+    {
+        none,
+        even,
+        odd
+    };
+
+    // LineSettings. Speed and framing of the bus, always 8 data bits.
+    // Packed in 32 bits to keep them in NVS and to hand them between tasks.
+    struct LineSettings
+    {
+        uint32_t _baud = 9600;
+        Parity _parity = Parity::none;
+        uint8_t _stopBits = 1;
+
+        bool operator==(const LineSettings &o) const
+        {
+            return _baud == o._baud && _parity == o._parity && _stopBits == o._stopBits;
+        }
+        bool operator!=(const LineSettings &o) const
+        {
+            return !(*this == o);
+        }
+        uint32_t pack() const
+        {
+            return _baud | uint32_t(_parity) << 24 | uint32_t(_stopBits) << 28;
+        }
+        static LineSettings unpack(uint32_t packed)
+        {
+            return LineSettings{packed & 0xFFFFFF, Parity((packed >> 24) & 0xF), uint8_t(packed >> 28)};
+        }
+        bool valid() const
+        {
+            return _baud >= 1200 && _baud <= 921600 && _parity <= Parity::odd && (_stopBits == 1 || _stopBits == 2);
+        }
+        // e.g. 9600 8N1
+        const char *toString(char *buf, size_t length) const
+        {
+            snprintf(buf, length, "%u 8%c%u", unsigned(_baud), "NEO"[int(_parity)], _stopBits);
+            return buf;
+        }
+    };
+
+    // The settings a SolarEdge inverter can be configured for, tried in this order. The more common ones first.
+    inline constexpr LineSettings line_candidates[] = {
+        {9600, Parity::none, 1},
+        {19200, Parity::none, 1},
+        {38400, Parity::none, 1},
+        {57600, Parity::none, 1},
+        {115200, Parity::none, 1},
+        {9600, Parity::even, 1},
+        {19200, Parity::even, 1},
+        {38400, Parity::even, 1},
+        {57600, Parity::even, 1},
+        {115200, Parity::even, 1},
+        {9600, Parity::odd, 1},
+        {19200, Parity::odd, 1},
+        {38400, Parity::odd, 1},
+        {57600, Parity::odd, 1},
+        {115200, Parity::odd, 1},
+        {9600, Parity::none, 2},
+        {19200, Parity::none, 2},
+        {38400, Parity::none, 2},
+        {57600, Parity::none, 2},
+        {115200, Parity::none, 2},
+    };
+    inline constexpr uint8_t number_line_candidates = sizeof(line_candidates) / sizeof(line_candidates[0]);
+
+    // LineDetector. Finds the settings of the bus from what the link receives. On settings that do not match the
+    // bus, frames fail their CRC and the UART reports framing or parity errors. Settings are kept once lock_frames
+    // frames with a valid CRC arrived in a row without an error, whoever they were addressed to. Until then the
+    // candidates are tried in turn, each for dwell ms or until lost_errors errors. Once locked, the settings are
+    // given up again when lost_errors errors came and no valid frame for lost ms, e.g. because the inverter was
+    // reconfigured.
+    // With automatic off, the settings are fixed.
+    // begin() and poll() are called by the task that owns the link. Other tasks read the settings and the state
+    // together with state(): the changes are published under a sequence counter like BlockValues, so a reader never
+    // sees e.g. the new settings with the old number of detections.
+    class LineDetector
+    {
+    public:
+        static constexpr unsigned long dwell = 3000;
+        static constexpr unsigned long lost = 10000;
+        static constexpr uint32_t lock_frames = 2;
+        static constexpr uint32_t lost_errors = 10;
+
+        struct State
+        {
+            LineSettings _settings;
+            bool _automatic;
+            // The settings are fixed or were detected
+            bool _locked;
+            uint32_t _detected;
+        };
+
+        void begin(const LineSettings &settings, bool automatic, unsigned long now, uint32_t frames, uint32_t errors)
+        {
+            publish([&]
+                    {
+                        _current.store(settings.pack(), std::memory_order_relaxed);
+                        _automatic.store(automatic, std::memory_order_relaxed);
+                        _locked.store(!automatic, std::memory_order_relaxed);
+                    });
+            restart(now, frames, errors);
+            // Detection starts from the settings given, then tries the candidates after it
+            _next = 0;
+            for (uint8_t i = 0; i < number_line_candidates; i++)
+            {
+                if (line_candidates[i] == settings)
+                    _next = (i + 1) % number_line_candidates;
+            }
+        }
+
+        // Returns true when the link has to be changed to settings()
+        bool poll(unsigned long now, uint32_t frames, uint32_t errors)
+        {
+            if (!_automatic.load(std::memory_order_relaxed))
+                return false;
+            if (_locked.load(std::memory_order_relaxed))
+            {
+                if (frames != _frames)
+                    restart(now, frames, errors);
+                if (errors - _errors < lost_errors || now - _since < lost)
+                    return false;
+                Serial.printf("RS485 errors without valid frames, detect the settings again\r\n");
+            }
+            else
+            {
+                // Only frames that follow each other without an error in between count
+                if (errors != _lastErrors)
+                {
+                    _lastErrors = errors;
+                    _cleanFrames = frames;
+                }
+                if (frames - _cleanFrames >= lock_frames)
+                {
+                    char buf[24];
+                    Serial.printf("RS485 settings detected: %s\r\n", settings().toString(buf, sizeof(buf)));
+                    publish([&]
+                            {
+                                _locked.store(true, std::memory_order_relaxed);
+                                _detected.store(_detected.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                            });
+                    restart(now, frames, errors);
+                    return false;
+                }
+                if (now - _since < dwell && errors - _errors < lost_errors)
+                    return false;
+            }
+            publish([&]
+                    {
+                        _locked.store(false, std::memory_order_relaxed);
+                        _current.store(line_candidates[_next].pack(), std::memory_order_relaxed);
+                    });
+            _next = (_next + 1) % number_line_candidates;
+            restart(now, frames, errors);
+            return true;
+        }
+
+        LineSettings settings() const
+        {
+            return LineSettings::unpack(_current.load(std::memory_order_relaxed));
+        }
+        // A consistent copy, from any task. Only retries when poll() changed the state meanwhile
+        State state() const
+        {
+            for (;;)
+            {
+                uint32_t sequence = _sequence.load(std::memory_order_acquire);
+                State s{settings(), _automatic.load(std::memory_order_relaxed), _locked.load(std::memory_order_relaxed),
+                        _detected.load(std::memory_order_relaxed)};
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if ((sequence & 1) == 0 && _sequence.load(std::memory_order_relaxed) == sequence)
+                    return s;
+            }
+        }
+
+    private:
+        // Writer side, the counter is odd while f changes the state
+        template <typename F>
+        void publish(F f)
+        {
+            uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+            _sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            f();
+            _sequence.store(sequence + 2, std::memory_order_release);
+        }
+        void restart(unsigned long now, uint32_t frames, uint32_t errors)
+        {
+            _since = now;
+            _frames = frames;
+            _errors = errors;
+            _cleanFrames = frames;
+            _lastErrors = errors;
+        }
+
+        std::atomic<uint32_t> _current{LineSettings().pack()};
+        std::atomic<bool> _locked{true};
+        std::atomic<bool> _automatic{false};
+        std::atomic<uint32_t> _detected{0};
+        std::atomic<uint32_t> _sequence{0};
+        uint8_t _next = 0;
+        unsigned long _since = 0;
+        uint32_t _frames = 0;
+        uint32_t _errors = 0;
+        uint32_t _cleanFrames = 0;
+        uint32_t _lastErrors = 0;
+    };
+}
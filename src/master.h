@@ -8,8 +8,16 @@
  */
 #pragma once
 
+#include <algorithm>
 #include "definitions.h"
-#include "ModbusTCP.h"
+#include "read_planner.h"
+#include "adaptive_window.h"
+#include "transaction_table.h"
+#include "scheduler.h"
+#include "connection.h"
+#include "rtt_estimator.h"
+#include "metrics.h"
+#include "transport.h"
 
 namespace modbus
 {
@@ -17,63 +25,175 @@ namespace modbus
     class Master
     {
     public:
-        Master(ModbusTCP &tcp, const IPAddress &remote)
-            : _dd(MODBUS_TYPE::getDeviceDescription()), _tcp(tcp), _remote(remote)
+        Master(ClientTransport &tcp, const IPAddress &remote, uint16_t port = 502, const ReadPlanner &planner = ReadPlanner(),
+               const AdaptiveWindow &window = AdaptiveWindow(max_transactions))
+            : _dd(MODBUS_TYPE::getDeviceDescription()), _window(window), _scheduler(MODBUS_TYPE::getSchedule()), _planner(planner), _tcp(tcp), _remote(remote),
+              _connection(tcp, remote, port)
         {
-            for (auto i = _dd._blocks.begin(); i < _dd._blocks.end(); i++)
+            for (auto i = std::begin(_rtt); i < std::end(_rtt); i++)
+                i->_max_timeout = library_timeout;
+            for (auto i = _dd.blocks().begin(); i < _dd.blocks().end(); i++)
             {
-                BlockValues v(*i, i->_number_reg);
+                BlockValues v(*i, _dd.registers(*i));
                 _blockValues.push_back(v);
             }
-            THIS = this;
         }
+        // Outstanding requests call back into this instance, so it can not be copied
+        Master(const Master &) = delete;
+        Master &operator=(const Master &) = delete;
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        float getFloatValue(RegisterType r)
+        using BlockType = typename MODBUS_TYPE::e_blocks;
+        float getFloatValue(RegisterType r) const
         {
-            float f = 0;
-            RegisterReference rr = _dd.getRegisterReference(r);
-            if (rr._block_idx >= 0 && rr._register_idx >= 0)
-            {
-                _blockValues[rr._block_idx].getFloatValue(rr, f);
-                // Serial.printf("%s=%f\r\n", rr._name, o);
-            }
-            else
-            {
-                Serial.printf("Can't find value %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
-            }
-            return f;
+            return getFloatValue(_dd.getRegisterReference(r));
+        }
+        float getFloatValue(const RegisterReference &rr) const
+        {
+            return _blockValues[rr._block_idx].getFloatValue(rr._register_idx);
+        }
+        // Variant with the register reference resolved at compile time
+        template <RegisterType R>
+        float getFloatValue() const
+        {
+            constexpr RegisterReference rr = MODBUS_TYPE::getDeviceDescription().getRegisterReference(R);
+            return getFloatValue(rr);
+        }
+        // The decoded values of all registers, indexed by RegisterType. Each block is copied at once, so its values
+        // come from one response. Returns false if a block was not received yet.
+        bool snapshot(float *values) const
+        {
+            bool result = true;
+            for (auto i = _blockValues.begin(); i < _blockValues.end(); i++)
+                result &= i->snapshot(values + i->_block._first_register);
+            return result;
         }
 
-        bool readBlockFromMeter(const String &name)
+        // Read a block from the meter as soon as possible, outside its schedule
+        void requestBlock(BlockType b)
         {
-            bool result = false;
-            // Avoid growing of transaction list. Allow maximum 50 entries
-            if (_transactionList.size() > 50)
-                _transactionList.erase(_transactionList.begin(), _transactionList.begin() + (_transactionList.size() - 50));
+            _scheduler.request(b, millis());
+            _pendingBlocks |= uint32_t(1) << b;
+        }
+
+        // Add the blocks that are due according to the schedule, then issue read requests for the pending blocks,
+        // as many as the in-flight window allows. Nearby pending blocks are merged into the same request and
+        // requests are sent earliest deadline first. Returns the number of requests issued.
+        // Nothing is sent while the connection is not usable, the blocks that are due then stay pending.
+        uint8_t readPendingFromMeter()
+        {
+            uint8_t result = 0;
+            unsigned long now = millis();
+            expire(now);
+            _pendingBlocks |= _scheduler.release(now, _pendingBlocks | inFlightBlocks());
+            if (!_connection.poll(now) || _pendingBlocks == 0)
+                return result;
 
-            if (_tcp.isConnected(_remote))
             {
-                modbus::BlockValues *b = getBlockValues(name);
-                if (b->_block._number_reg > 0)
+                ReadRequest requests[number_blocks];
+                uint8_t n = _planner.plan(_dd.blocks(), _pendingBlocks, requests, number_blocks);
+                _scheduler.order(requests, n);
+                for (uint8_t i = 0; i < n && inFlight() < _window.size(); i++)
                 {
-                    uint16_t t = _tcp.readIreg(_remote, b->_block._offset, b->_values.data(), b->_block._number_reg, &cbReadIreg);
-                    if (t > 0)
-                    {
-                        result = true;
-                        _transactionList.push_back({b, t});
-                    }
+                    Transaction *t = getFreeTransaction();
+                    if (!t)
+                        break;
+                    t->_request = requests[i];
+                    // The callback routes to this instance. A lambda capturing only this is stored inside
+                    // the std::function itself, so no heap is used.
+                    uint16_t id = _tcp.readIreg(_remote, t->_request._offset, t->_buffer, t->_request._number_reg,
+                                                [this](Modbus::ResultCode event, uint16_t transaction, void *data)
+                                                { return onReadIreg(event, transaction, data); });
+                    if (id == 0)
+                        break;
+                    _index.insert(id, t - _transactions);
+                    result++;
+                    t->_transaction = id;
+                    t->_sent = millis();
+                    t->_timeout = timeoutFor(t->_request._number_reg);
+                    t->_expired = false;
+                    _pendingBlocks &= ~t->_request._blocks;
                 }
             }
-            else
+
+            return result;
+        }
+
+        // Time until readPendingFromMeter has something to do, at most limit: a block is released, a request times
+        // out or the connection is retried. A response can come earlier, it arrives on socket().
+        // Pending blocks that could be sent but were not, because the transport refused them, are tried again
+        // after retry_send.
+        unsigned long nextEvent(unsigned long now, unsigned long limit) const
+        {
+            unsigned long result = _scheduler.nextRelease(now, limit);
+            result = _connection.nextPoll(now, result);
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
             {
-                bool val = _tcp.connect(_remote, 502);
-                Serial.print("tcp.connect=");
-                Serial.println(val);
+                if (i->_transaction != 0 && !i->_expired)
+                    result = std::min(result, (unsigned long)std::max(long(i->_sent + i->_timeout + 1 - now), 0l));
             }
+            bool usable = _connection.state() == ConnectionState::up || _connection.state() == ConnectionState::degraded;
+            bool free = std::any_of(std::begin(_transactions), std::end(_transactions), [](const Transaction &t)
+                                    { return t._transaction == 0; });
+            if (_pendingBlocks != 0 && usable && free && inFlight() < _window.size())
+                result = std::min(result, retry_send);
+            return result;
+        }
+        // Socket the responses of the meter arrive on, -1 while not connected
+        int socket() const
+        {
+            return _tcp.socket(_remote);
+        }
+
+        const IPAddress &remote() const
+        {
+            return _remote;
+        }
+        const Connection &connection() const
+        {
+            return _connection;
+        }
+        // E.g. to change max_timeouts
+        Connection &connection()
+        {
+            return _connection;
+        }
+        // Response times of the requests that delivered the data of a block
+        const LatencyHistogram &latency(uint16_t block) const
+        {
+            return _latency[block];
+        }
+        // Results of the requests as reported by the library
+        const ResultCounters &results() const
+        {
+            return _results;
+        }
+        // Requests that timed out before the library reported a result
+        uint32_t expired() const
+        {
+            return _expired;
+        }
 
+        // Blocks covered by the requests outstanding at the meter. Requests that timed out are not counted.
+        uint32_t inFlightBlocks() const
+        {
+            uint32_t result = 0;
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
+            {
+                if (i->_transaction != 0 && !i->_expired)
+                    result |= i->_request._blocks;
+            }
             return result;
         }
 
+        // Number of requests currently outstanding at the meter. Requests that timed out are not counted.
+        uint8_t inFlight() const
+        {
+            uint8_t n = 0;
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
+                n += i->_transaction != 0 && !i->_expired;
+            return n;
+        }
+
         String allValueAsString() const
         {
             String r = "";
@@ -82,80 +202,226 @@ namespace modbus
             return r;
         }
 
+        // How well the schedule of each block is met
+        String scheduleAsString() const
+        {
+            String result;
+            char buf[200];
+            sprintf(buf, "Meter %s: connection %s, connects=%u, response time=%lu ms, late responses=%u\r\n", _remote.toString().c_str(),
+                    _connection.stateName(), _connection._connects, _responseTime, _lateResponses);
+            result += buf;
+            for (uint8_t c = 0; c < size_classes; c++)
+            {
+                const RttEstimator &e = _rtt[c];
+                sprintf(buf, "Requests of %u-%u registers: rtt=%lu ms (+/-%lu), timeout=%lu ms, responses=%u, timeouts=%u\r\n", c * size_class_width,
+                        c + 1 < size_classes ? (c + 1) * size_class_width - 1 : DeviceDescription<MODBUS_TYPE>::max_block_size,
+                        e.srtt(), e.rttvar(), e.timeout(), e.samples(), e.timeouts());
+                result += buf;
+            }
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const BlockTiming &t = _scheduler.timing(b);
+                sprintf(buf, "Block %s: period=%u ms, read=%u, collapsed=%u, late=%u, max lateness=%lu ms, jitter mean=%lu ms max=%lu ms\r\n",
+                        _dd.blocks()[b]._name, _scheduler.period(b), t._completed, t._collapsed, t._late, t._maxLateness,
+                        t._completed > 1 ? t._sumJitter / (t._completed - 1) : 0, t._maxJitter);
+                result += buf;
+            }
+            return result;
+        }
+
         bool _dataRead = false;
+        // Smoothed time between sending a request and receiving its response, in ms
+        unsigned long _responseTime = 0;
         const DeviceDescription<MODBUS_TYPE> &_dd;
+        AdaptiveWindow _window;
+        Scheduler<MODBUS_TYPE> _scheduler;
+
     private:
-        BlockValues *getBlockValues(const String &name)
+        static constexpr uint16_t number_blocks = DeviceDescription<MODBUS_TYPE>::number_blocks;
+        static_assert(number_blocks <= 32, "Pending blocks are kept in a 32 bit mask");
+
+        // Keep a fixed set of transactions. The response of a request is received in the buffer of its transaction
+        // and then copied to the blocks covered by the request. Transactions are found back by id through _index.
+        static constexpr uint8_t max_transactions = 4;
+        static constexpr unsigned long retry_send = 10;
+        // A request that timed out keeps its transaction until the library calls back, the response would otherwise
+        // be received in the buffer of a newer request.
+        struct Transaction
         {
-            for (auto i = _blockValues.begin(); i < _blockValues.end(); i++)
+            ReadRequest _request;
+            uint16_t _transaction = 0;
+            unsigned long _sent = 0;
+            unsigned long _timeout = 0;
+            bool _expired = false;
+            uint16_t _buffer[DeviceDescription<MODBUS_TYPE>::max_block_size];
+        };
+
+        // The library times out every request after the same MODBUSIP_TIMEOUT. Requests time out earlier when the
+        // response times measured for requests of their size allow. Larger requests take longer at the meter,
+        // so response times are kept per size class.
+#ifdef MODBUSIP_TIMEOUT
+        static constexpr uint16_t library_timeout = MODBUSIP_TIMEOUT;
+#else
+        static constexpr uint16_t library_timeout = 1000;
+#endif
+        static constexpr uint8_t size_classes = 4;
+        static constexpr uint16_t size_class_width = 32;
+        static uint8_t sizeClass(uint16_t number_reg)
+        {
+            return std::min<uint16_t>(number_reg / size_class_width, size_classes - 1);
+        }
+        // A size class without responses yet takes the longest timeout of the measured classes
+        unsigned long timeoutFor(uint16_t number_reg) const
+        {
+            const RttEstimator &e = _rtt[sizeClass(number_reg)];
+            if (e.measured())
+                return e.timeout();
+            unsigned long result = 0;
+            for (auto i = std::begin(_rtt); i < std::end(_rtt); i++)
             {
-                if (i->_block._name == name)
-                    return &(*i);
+                if (i->measured())
+                    result = std::max(result, i->timeout());
+            }
+            return result > 0 ? result : e.timeout();
+        }
+        // Time out the requests that waited longer than their timeout. Their blocks are read again.
+        void expire(unsigned long now)
+        {
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
+            {
+                if (i->_transaction == 0 || i->_expired || now - i->_sent <= i->_timeout)
+                    continue;
+                Serial.printf("ERROR: Request for transaction %i, offset=0x%04x timed out after %lu ms\r\n", i->_transaction, i->_request._offset,
+                              i->_timeout);
+                i->_expired = true;
+                _expired++;
+                _pendingBlocks |= i->_request._blocks;
+                if (timedOut(i->_request, i->_sent, now))
+                    break;
+            }
+        }
+        // Returns true if the connection was reset, all transactions are then dropped and their blocks read again.
+        // Like TCP, requests that were sent before the previous timeout are part of the same loss and are not counted again,
+        // only requests sent with the doubled timeout are.
+        bool timedOut(const ReadRequest &r, unsigned long sent, unsigned long now)
+        {
+            if (_timedOut && (long)(sent - _lastTimeout) < 0)
+                return false;
+            _timedOut = true;
+            _lastTimeout = now;
+            _rtt[sizeClass(r._number_reg)].onTimeout();
+            _window.onTimeout();
+            if (!_connection.onTimeout(now))
+                return false;
+            // Scheduler::release already moved these blocks on by a period, dropped they would wait a whole period
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
+            {
+                if (i->_transaction != 0)
+                    _pendingBlocks |= i->_request._blocks;
+                i->_transaction = 0;
+            }
+            _index.clear();
+            return true;
+        }
+        Transaction *getFreeTransaction()
+        {
+            for (auto i = std::begin(_transactions); i < std::end(_transactions); i++)
+            {
+                if (i->_transaction == 0)
+                    return i;
             }
             return 0;
         }
-        static bool cbReadIreg(Modbus::ResultCode event, uint16_t transaction, void *data)
+        void scatter(const Transaction &t, uint16_t transaction, unsigned long responseTime)
+        {
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                if (!(t._request._blocks & (uint32_t(1) << b)))
+                    continue;
+                BlockValues &v = _blockValues[b];
+                v.update(t._buffer + (v._block._offset - t._request._offset), transaction);
+                _scheduler.completed(b, millis());
+                _latency[b].observe(responseTime);
+            }
+        }
+        bool onReadIreg(Modbus::ResultCode event, uint16_t transaction, void *)
         {
-            static bool hasAlreadyTimedOut = false;
+            _results.count(event);
             if (event != Modbus::EX_SUCCESS)                                  // If transaction got an error
                 Serial.printf("Modbus result: %02X %i ", event, transaction); // Display Modbus error code
             else
-                hasAlreadyTimedOut = false;
-
-            if (event == Modbus::EX_TIMEOUT)
-            { // If Transaction timeout took place
-                if (hasAlreadyTimedOut)
-                {
-                    Serial.printf("Reset Modbus RTU connection");
-                    THIS->_tcp.disconnect(THIS->_remote); // Close connection to slave and
-                    THIS->_tcp.dropTransactions();        // Cancel all waiting transactions
-                    hasAlreadyTimedOut = false;
-                }
-                else
-                {
-                    hasAlreadyTimedOut = true;
-                }
-            }
+                _connection.onSuccess();
 
-            modbus::BlockValues *b = 0;
-            for (auto i = THIS->_transactionList.begin(); i < THIS->_transactionList.end(); i++)
+            int16_t slot = _index.find(transaction);
+            if (slot < 0)
             {
-                if (i->_transaction == transaction)
-                {
-                    b = i->_block;
-                    THIS->_transactionList.erase(i);
-                    break;
-                }
+                Serial.printf("ERROR: Request for transaction %i not found\r\n", transaction);
+                return true;
             }
-            if (b)
+            Transaction &t = _transactions[slot];
+            if (event == Modbus::EX_SUCCESS)
             {
-                if (event == Modbus::EX_SUCCESS)
+                unsigned long responseTime = millis() - t._sent;
+                // Transaction ids are unique, so a response that comes after the timeout is still a valid sample
+                _rtt[sizeClass(t._request._number_reg)].onResponse(responseTime);
+                if (t._expired)
                 {
-                    b->_transaction = transaction;
-                    THIS->_dataRead = true;
+                    // Its blocks were requested again, the data of that request is more recent
+                    _lateResponses++;
                 }
                 else
                 {
-                    Serial.printf("ERROR: Block for transaction %i, blockname=%s\r\n", transaction, b->_block._name.c_str());
+                    _window.onResponse(responseTime);
+                    _responseTime = _responseTime == 0 ? responseTime : (7 * _responseTime + responseTime) / 8;
+                    scatter(t, transaction, responseTime);
+                    _dataRead = true;
                 }
             }
             else
             {
-                Serial.printf("ERROR: Block for transaction %i not found\r\n", transaction);
+                Serial.printf("ERROR: Request for transaction %i, offset=0x%04x failed\r\n", transaction, t._request._offset);
+                // A merged read spans registers between the blocks that the meter may not map. If it refuses one,
+                // read its blocks one by one from now on, otherwise none of them would be updated again.
+                uint32_t blocks = t._request._blocks;
+                if ((event == Modbus::EX_ILLEGAL_ADDRESS || event == Modbus::EX_ILLEGAL_VALUE) && (blocks & (blocks - 1)) != 0 && _planner.merges())
+                {
+                    Serial.printf("Meter %s refused a merged read, reading its blocks one by one\r\n", _remote.toString().c_str());
+                    _planner = ReadPlanner::perBlock();
+                    _pendingBlocks |= blocks;
+                }
+            }
+            bool expired = t._expired;
+            ReadRequest request = t._request;
+            unsigned long sent = t._sent;
+            t._transaction = 0;
+            _index.erase(transaction);
+
+            // Cancelled when the connection is reset, see timedOut
+            if (event == Modbus::EX_CANCEL)
+                _pendingBlocks |= request._blocks;
+            // A request that already timed out is not counted again
+            if (event == Modbus::EX_TIMEOUT && !expired)
+            {
+                _pendingBlocks |= request._blocks;
+                timedOut(request, sent, millis());
             }
 
             return true;
         }
-        // Keep list of transactions, to retrieve the block related to the transaction
-        struct Transaction
-        {
-            modbus::BlockValues *_block;
-            uint16_t _transaction;
-        };
-        static inline Master *THIS = 0;
-        std::vector<Transaction> _transactionList;
-        ModbusTCP &_tcp;
+        ReadPlanner _planner;
+        Transaction _transactions[max_transactions];
+        TransactionTable<2 * max_transactions> _index;
+        uint32_t _pendingBlocks = 0;
+        ClientTransport &_tcp;
         IPAddress _remote;
+        Connection _connection;
+        RttEstimator _rtt[size_classes];
+        bool _timedOut = false;
+        unsigned long _lastTimeout = 0;
+        uint32_t _lateResponses = 0;
+        uint32_t _expired = 0;
+        LatencyHistogram _latency[number_blocks];
+        ResultCounters _results;
         std::vector<BlockValues> _blockValues;
     };
 }
\ No newline at end of file
@@ -0,0 +1,189 @@
+/**
+ * @file      meter_aggregate.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Combine the values of several meters of the same type into the values of one meter
+ */
+#pragma once
+
+#include "definitions.h"
+#include "master.h"
+#include <lwip/sockets.h>
+#include <cmath>
+
+namespace modbus
+{
+    // MeterAggregate. Presents several meters as one. Active and reactive power and energy are summed over the meters,
+    // each meter added or subtracted according to its sign. A sub-meter that is part of the first meter gets -1,
+    // a separate feed that is not seen by the first meter gets 1.
+    // Apparent power and power factor are derived from the summed active and reactive power, see
+    // MODBUS_TYPE::getCombinations. Other quantities (voltage, current, maxima, frequency, time) do not add up and are
+    // taken from the first meter. A single meter is passed through as it is. The values are read from a Snapshot.
+    template <typename MODBUS_TYPE, uint8_t max_meters = 3>
+    class MeterAggregate
+    {
+    public:
+        using RegisterType = typename MODBUS_TYPE::e_registers;
+        MeterAggregate(Master<MODBUS_TYPE> *meters, const int8_t *signs, uint8_t number_meters)
+            : _number_meters(number_meters < max_meters ? number_meters : max_meters)
+        {
+            for (uint8_t i = 0; i < _number_meters; i++)
+            {
+                _meters[i] = &meters[i];
+                _signs[i] = signs[i];
+            }
+        }
+
+        // Snapshot. The decoded values of all meters at one moment, see snapshot. Read from it like from one meter.
+        class Snapshot
+        {
+        public:
+            template <RegisterType R>
+            float getFloatValue() const
+            {
+                constexpr RegisterCombination<MODBUS_TYPE> c = combination(R);
+                return getFloatValue(c._combination, R, c._active, c._reactive);
+            }
+            float getFloatValue(RegisterType r) const
+            {
+                RegisterCombination<MODBUS_TYPE> c = combination(r);
+                return getFloatValue(c._combination, r, c._active, c._reactive);
+            }
+
+        private:
+            friend class MeterAggregate;
+            float getFloatValue(Combination combination, RegisterType r, RegisterType active, RegisterType reactive) const
+            {
+                if (_number_meters == 1)
+                    return _values[0][r];
+                switch (combination)
+                {
+                case Combination::sum:
+                    return sum(r);
+                case Combination::apparent:
+                    return std::hypot(sum(active), sum(reactive));
+                case Combination::power_factor:
+                {
+                    float p = sum(active);
+                    float s = std::hypot(p, sum(reactive));
+                    // Without load the power factor is 1
+                    return s > 0 ? p / s : 1;
+                }
+                default:
+                    return _values[0][r];
+                }
+            }
+            float sum(RegisterType r) const
+            {
+                float result = 0;
+                for (uint8_t i = 0; i < _number_meters; i++)
+                    result += _signs[i] * _values[i][r];
+                return result;
+            }
+            uint8_t _number_meters = 0;
+            int8_t _signs[max_meters] = {};
+            float _values[max_meters][DeviceDescription<MODBUS_TYPE>::number_registers] = {};
+        };
+
+        // Copy the values of all meters into s, block by block with BlockValues::snapshot, so the values of a block
+        // all come from the same response even when a response arrives meanwhile.
+        // Returns false if a block of a meter was not received yet.
+        bool snapshot(Snapshot &s) const
+        {
+            bool result = true;
+            s._number_meters = _number_meters;
+            for (uint8_t i = 0; i < _number_meters; i++)
+            {
+                s._signs[i] = _signs[i];
+                result &= _meters[i]->snapshot(s._values[i]);
+            }
+            return result;
+        }
+
+        // True when any of the meters received new data since the last call
+        bool takeDataRead()
+        {
+            bool result = false;
+            for (uint8_t i = 0; i < _number_meters; i++)
+            {
+                result |= _meters[i]->_dataRead;
+                _meters[i]->_dataRead = false;
+            }
+            return result;
+        }
+
+        // Sleep until a meter answers, or until one of them has something to do, at most limit ms.
+        // Returns false if it slept for the time.
+        bool wait(unsigned long limit)
+        {
+            unsigned long now = millis();
+            unsigned long timeout = limit;
+            fd_set readable;
+            FD_ZERO(&readable);
+            int last = -1;
+            for (uint8_t i = 0; i < _number_meters; i++)
+            {
+                timeout = _meters[i]->nextEvent(now, timeout);
+                int fd = _meters[i]->socket();
+                if (fd < 0)
+                    continue;
+                FD_SET(fd, &readable);
+                last = std::max(last, fd);
+            }
+            if (timeout == 0)
+                return true;
+            if (last < 0)
+            {
+                delay(timeout);
+                return false;
+            }
+            struct timeval tv = {long(timeout / 1000), long(timeout % 1000) * 1000};
+            int n = select(last + 1, &readable, nullptr, nullptr, &tv);
+            if (n < 0)
+                delay(timeout);
+            return n > 0;
+        }
+
+        uint8_t size() const
+        {
+            return _number_meters;
+        }
+        Master<MODBUS_TYPE> &operator[](uint8_t i) const
+        {
+            return *_meters[i];
+        }
+
+    private:
+        static constexpr bool equal(const char *a, const char *b)
+        {
+            while (*a && *a == *b)
+            {
+                a++;
+                b++;
+            }
+            return *a == *b;
+        }
+        // How the meters are combined for a register: as listed by MODBUS_TYPE::getCombinations, otherwise summed
+        // when its unit adds up and taken from the first meter when it does not
+        static constexpr RegisterCombination<MODBUS_TYPE> combination(RegisterType r)
+        {
+            for (auto c : MODBUS_TYPE::getCombinations())
+            {
+                if (c._register == r)
+                    return c;
+            }
+            constexpr const char *units[] = {"W", "VAr", "kWh", "Kvarh"};
+            for (auto u : units)
+            {
+                if (equal(u, MODBUS_TYPE::getDeviceDescription().getRegister(r)._unit))
+                    return {r, Combination::sum, r, r};
+            }
+            return {r, Combination::first, r, r};
+        }
+        uint8_t _number_meters;
+        Master<MODBUS_TYPE> *_meters[max_meters];
+        int8_t _signs[max_meters];
+    };
+}
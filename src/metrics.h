@@ -0,0 +1,204 @@
+/**
+ * @file      metrics.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Counters and histograms, rendered in the Prometheus text format without using the heap
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <Modbus.h>
+
+namespace modbus
+{
+    // Bucket bounds of the response times of the meter and of the loop
+    inline constexpr uint32_t latency_buckets_ms[] = {10, 20, 50, 100, 200, 500, 1000, 2000};
+    inline constexpr uint32_t loop_buckets_us[] = {100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000};
+
+    // Histogram. Counts observations in fixed buckets, each bucket holding the values up to its upper bound.
+    // Values above the last bound are only counted in the total.
+    template <const auto &bounds>
+    class Histogram
+    {
+    public:
+        static constexpr size_t N = sizeof(bounds) / sizeof(bounds[0]);
+
+        void observe(uint32_t value)
+        {
+            for (size_t i = 0; i < N; i++)
+            {
+                if (value <= bounds[i])
+                {
+                    _counts[i]++;
+                    break;
+                }
+            }
+            _sum += value;
+            _count++;
+        }
+
+        static constexpr size_t size()
+        {
+            return N;
+        }
+        static constexpr uint32_t bound(size_t i)
+        {
+            return bounds[i];
+        }
+        uint32_t count(size_t i) const
+        {
+            return _counts[i];
+        }
+        uint32_t count() const
+        {
+            return _count;
+        }
+        uint64_t sum() const
+        {
+            return _sum;
+        }
+
+    private:
+        uint32_t _counts[N] = {};
+        uint32_t _count = 0;
+        uint64_t _sum = 0;
+    };
+
+    using LatencyHistogram = Histogram<latency_buckets_ms>;
+    using LoopHistogram = Histogram<loop_buckets_us>;
+
+    // ResultCounters. Number of requests per Modbus result code
+    class ResultCounters
+    {
+    public:
+        struct Code
+        {
+            Modbus::ResultCode _code;
+            const char *_name;
+        };
+        static constexpr Code codes[] = {
+            {Modbus::EX_SUCCESS, "success"},
+            {Modbus::EX_ILLEGAL_FUNCTION, "illegal_function"},
+            {Modbus::EX_ILLEGAL_ADDRESS, "illegal_address"},
+            {Modbus::EX_ILLEGAL_VALUE, "illegal_value"},
+            {Modbus::EX_SLAVE_FAILURE, "slave_failure"},
+            {Modbus::EX_ACKNOWLEDGE, "acknowledge"},
+            {Modbus::EX_SLAVE_DEVICE_BUSY, "slave_device_busy"},
+            {Modbus::EX_MEMORY_PARITY_ERROR, "memory_parity_error"},
+            {Modbus::EX_PATH_UNAVAILABLE, "path_unavailable"},
+            {Modbus::EX_DEVICE_FAILED_TO_RESPOND, "device_failed_to_respond"},
+            {Modbus::EX_GENERAL_FAILURE, "general_failure"},
+            {Modbus::EX_DATA_MISMACH, "data_mismatch"},
+            {Modbus::EX_UNEXPECTED_RESPONSE, "unexpected_response"},
+            {Modbus::EX_TIMEOUT, "timeout"},
+            {Modbus::EX_CONNECTION_LOST, "connection_lost"},
+            {Modbus::EX_CANCEL, "cancel"},
+            {Modbus::EX_PASSTHROUGH, "passthrough"},
+            {Modbus::EX_FORCE_PROCESS, "force_process"},
+        };
+        static constexpr size_t number_codes = sizeof(codes) / sizeof(codes[0]);
+
+        void count(Modbus::ResultCode code)
+        {
+            for (size_t i = 0; i < number_codes; i++)
+            {
+                if (codes[i]._code == code)
+                {
+                    _counts[i]++;
+                    return;
+                }
+            }
+            _other++;
+        }
+        uint32_t count(size_t i) const
+        {
+            return _counts[i];
+        }
+        uint32_t other() const
+        {
+            return _other;
+        }
+
+    private:
+        uint32_t _counts[number_codes] = {};
+        uint32_t _other = 0;
+    };
+
+    // MetricsWriter. Renders the Prometheus text format into a fixed buffer, which is handed to the sink whenever
+    // it is full and at the end. Nothing is allocated, however large the output.
+    class MetricsWriter
+    {
+    public:
+        using Sink = void (*)(const char *data, size_t length);
+
+        MetricsWriter(Sink sink) : _sink(sink)
+        {
+        }
+        ~MetricsWriter()
+        {
+            flush();
+        }
+
+        void printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+        {
+            for (uint8_t attempt = 0; attempt < 2; attempt++)
+            {
+                va_list args;
+                va_start(args, format);
+                int n = vsnprintf(_buffer + _length, sizeof(_buffer) - _length, format, args);
+                va_end(args);
+                if (n < 0)
+                    return;
+                if (_length + n < sizeof(_buffer))
+                {
+                    _length += n;
+                    return;
+                }
+                // Did not fit, send what is there and try again in the empty buffer. A line longer than the buffer is cut.
+                if (_length == 0)
+                {
+                    _length = sizeof(_buffer) - 1;
+                    return;
+                }
+                flush();
+            }
+        }
+
+        // The HELP and TYPE lines that precede the samples of a metric
+        void family(const char *name, const char *type, const char *help)
+        {
+            printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        }
+
+        // The samples of a histogram. The bounds are divided by scale, e.g. 1000 to render ms as seconds.
+        template <typename HISTOGRAM>
+        void histogram(const char *name, const char *labels, const HISTOGRAM &h, uint32_t scale)
+        {
+            const char *separator = labels[0] ? "," : "";
+            uint32_t cumulative = 0;
+            for (size_t i = 0; i < h.size(); i++)
+            {
+                cumulative += h.count(i);
+                printf("%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, separator, double(h.bound(i)) / scale, cumulative);
+            }
+            printf("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, separator, h.count());
+            printf("%s_sum{%s} %g\n", name, labels, double(h.sum()) / scale);
+            printf("%s_count{%s} %u\n", name, labels, h.count());
+        }
+
+        void flush()
+        {
+            if (_length > 0)
+                _sink(_buffer, _length);
+            _length = 0;
+        }
+
+    private:
+        Sink _sink;
+        char _buffer[1024];
+        size_t _length = 0;
+    };
+}
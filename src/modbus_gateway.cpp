@@ -17,19 +17,23 @@
 #include <SD.h>
 #include <WebServer.h>
 #include <ESPmDNS.h>
-#include <queue>
 #include <WiFi.h>
 #include <ArduinoOTA.h>
-#include <ModbusTCP.h>
-#include <ModbusRTU.h>
+#include <Preferences.h>
 
 #include "utilities.h" //Board PinMap
 #include "definitions.h"
+#include "esp_transport.h"
 #include "slave.h"
 #include "master.h"
 #include "em24.h"
 #include "wattnode.h"
+#include "meter_aggregate.h"
 #include "convert_em24_to_wattnode.h"
+#include "metrics.h"
+#include "line_settings.h"
+#include "spsc_queue.h"
+#include "alloc_counter.h"
 
 static bool eth_connected = false;
 WebServer server(80);
@@ -46,52 +50,320 @@ WebServer server(80);
 // #define REMOTE "192.168.1.2"
 // #define SLAVE_ID 2
 
+// Optional additional meters, also from secrets.ini. Their power and energy are added to (SIGN 1) or
+// subtracted from (SIGN -1) the values of the REMOTE meter before conversion. Without a SIGN they are added.
+// #define REMOTE2 "192.168.1.3"
+// #define REMOTE2_SIGN -1
+// #define REMOTE3 "192.168.1.4"
+// #define REMOTE3_SIGN 1
+#ifndef REMOTE2_SIGN
+#define REMOTE2_SIGN 1
+#endif
+#ifndef REMOTE3_SIGN
+#define REMOTE3_SIGN 1
+#endif
+
+// Optional second WattNode on the same RS485 bus, e.g. a production meter next to the consumption meter, also from
+// secrets.ini. It answers its own slave ID from its own register image, converted from its own meter.
+// #define SLAVE2_ID 3
+// #define SLAVE2_REMOTE "192.168.1.5"
+// #define SLAVE2_SERIAL_NUMBER 1234568
+#if defined(SLAVE2_ID) && !defined(SLAVE2_REMOTE)
+#error "SLAVE2_ID needs SLAVE2_REMOTE"
+#endif
+#if defined(SLAVE2_ID) && !defined(SLAVE2_SERIAL_NUMBER)
+#define SLAVE2_SERIAL_NUMBER (SERIAL_NUMBER + 1)
+#endif
+
 // TCP Master
-IPAddress remote()
+IPAddress remote(const char *address)
 {
     IPAddress a;
-    a.fromString(REMOTE);
+    a.fromString(address);
     return a;
 }
-ModbusTCP tcp;
-modbus::Master<modbus::EM24> meter(tcp, remote());
+// Each meter has its own TCP connection, so that resetting one connection does not cancel requests to the others
+const int8_t meterSigns[] = {
+    1,
+#ifdef REMOTE2
+    REMOTE2_SIGN,
+#endif
+#ifdef REMOTE3
+    REMOTE3_SIGN,
+#endif
+};
+// The meters of the first WattNode, then the meter of the second one
+constexpr uint8_t number_meters1 = sizeof(meterSigns) / sizeof(meterSigns[0]);
+#ifdef SLAVE2_ID
+constexpr uint8_t number_meters = number_meters1 + 1;
+#else
+constexpr uint8_t number_meters = number_meters1;
+#endif
+modbus::EspTcpClient tcp[number_meters];
+modbus::Master<modbus::EM24> meters[number_meters] = {
+    {tcp[0], remote(REMOTE)},
+#ifdef REMOTE2
+    {tcp[1], remote(REMOTE2)},
+#endif
+#ifdef REMOTE3
+    {tcp[number_meters1 - 1], remote(REMOTE3)},
+#endif
+#ifdef SLAVE2_ID
+    {tcp[number_meters - 1], remote(SLAVE2_REMOTE)},
+#endif
+};
+modbus::MeterAggregate<modbus::EM24> meter(meters, meterSigns, number_meters1);
 
-// TCP Slave
-ModbusRTU rtu;
+// RTU Slave, one server for all WattNodes on the bus
+modbus::EspSerialLink rs485;
+modbus::RtuServer rtu(rs485);
 modbus::Slave<modbus::WattNode> wattnode(rtu, SLAVE_ID);
 
 // Converter mapping
 modbus::ConvertEM24ToWattNode converter(meter, wattnode);
 
+#ifdef SLAVE2_ID
+modbus::MeterAggregate<modbus::EM24> meter2(meters + number_meters1, meterSigns, 1);
+modbus::Slave<modbus::WattNode> wattnode2(rtu, SLAVE2_ID);
+modbus::ConvertEM24ToWattNode converter2(meter2, wattnode2);
+#endif
+
+// A WattNode with the meters it is converted from, meters[_first] up to meters[_first + _meter.size() - 1].
+// Each is polled and converted by its own meter task.
+struct Feed
+{
+    uint8_t _slaveId;
+    uint8_t _first;
+    modbus::MeterAggregate<modbus::EM24> &_meter;
+    modbus::Slave<modbus::WattNode> &_wattnode;
+    modbus::ConvertEM24ToWattNode &_converter;
+    // Time spent in one round of the meter task, without the wait at its end
+    modbus::LoopHistogram _loopTime;
+};
+Feed feeds[] = {
+    {SLAVE_ID, 0, meter, wattnode, converter},
+#ifdef SLAVE2_ID
+    {SLAVE2_ID, number_meters1, meter2, wattnode2, converter2},
+#endif
+};
+constexpr uint8_t number_feeds = sizeof(feeds) / sizeof(feeds[0]);
+
 // How thr RS485 port is connected to pins
 #define BOARD_485_TX 33
 #define BOARD_485_RX 32
 #define Serial485 Serial2
+#define UART485 UART_NUM_2
 
-// Room for 3 timed events
-unsigned long prevTime1;
-unsigned long prevTime2;
-unsigned long prevTime3;
+// Speed and framing of the RS485 bus, kept in NVS. Fixed, or detected from the frames of the inverter.
+// The web server hands new settings to the RTU task, which owns the port.
+struct LineCommand
+{
+    modbus::LineSettings _settings;
+    bool _automatic;
+};
+Preferences preferences;
+modbus::LineDetector line;
+modbus::SpscQueue<LineCommand, 4> lineCommands;
+uint32_t storedLine = 0;
 
 void handleRoot()
 {
     String r = "\
     <a href=\"./wattnode\">WattNode values</a><br/>\
     <a href=\"./meter\">Meter values</a><br/>\
+    <a href=\"./schedule\">Meter polling schedule</a><br/>\
     <a href=\"./description\">Description of WattNode and Meter device</a><br/>\
+    <a href=\"./metrics\">Metrics (Prometheus)</a><br/>\
+    <a href=\"./queries\">Queries of the inverter</a><br/>\
+    <a href=\"./rs485\">RS485 settings</a><br/>\
     ";
     server.send(200, "text/html", r.c_str());
 }
 
 void handleMeter()
 {
-    String r = meter.allValueAsString();
+    String r;
+    for (uint8_t i = 0; i < number_meters; i++)
+        r += meters[i].allValueAsString();
+    server.send(200, "text/plain", r.c_str());
+}
+
+void handleSchedule()
+{
+    String r;
+    for (uint8_t f = 0; f < number_feeds; f++)
+    {
+        r += "WattNode " + String(feeds[f]._slaveId) + " reads\r\n";
+        r += feeds[f]._wattnode._demand.toString(millis());
+    }
+    for (uint8_t i = 0; i < number_meters; i++)
+        r += meters[i].scheduleAsString();
+    server.send(200, "text/plain", r.c_str());
+}
+
+void sendMetrics(const char *data, size_t length)
+{
+    server.sendContent(data, length);
+}
+
+// Prometheus text format, sent in chunks from a fixed buffer
+void handleMetrics()
+{
+    server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server.send(200, "text/plain; version=0.0.4", "");
+    unsigned long now = millis();
+    char labels[80];
+    {
+        modbus::MetricsWriter w(sendMetrics);
+        auto meterLabel = [&](uint8_t i, const char *name, const char *value)
+        {
+            const IPAddress &r = meters[i].remote();
+            snprintf(labels, sizeof(labels), "meter=\"%u.%u.%u.%u\",%s=\"%s\"", r[0], r[1], r[2], r[3], name, value);
+        };
+        modbus::Span<modbus::Block> meterBlocks = modbus::EM24::getDeviceDescription().blocks();
+
+        w.family("modbus_meter_request_duration_seconds", "histogram", "Response time of the requests that delivered the data of a meter block");
+        for (uint8_t i = 0; i < number_meters; i++)
+            for (uint16_t b = 0; b < meterBlocks.size(); b++)
+            {
+                meterLabel(i, "block", meterBlocks[b]._name);
+                w.histogram("modbus_meter_request_duration_seconds", labels, meters[i].latency(b), 1000);
+            }
+
+        w.family("modbus_meter_requests_total", "counter", "Requests to a meter per result code");
+        for (uint8_t i = 0; i < number_meters; i++)
+        {
+            const modbus::ResultCounters &c = meters[i].results();
+            for (size_t r = 0; r < c.number_codes; r++)
+            {
+                meterLabel(i, "result", c.codes[r]._name);
+                w.printf("modbus_meter_requests_total{%s} %u\n", labels, c.count(r));
+            }
+            meterLabel(i, "result", "other");
+            w.printf("modbus_meter_requests_total{%s} %u\n", labels, c.other());
+        }
+
+        w.family("modbus_meter_requests_expired_total", "counter", "Requests to a meter that timed out on the adaptive timeout");
+        for (uint8_t i = 0; i < number_meters; i++)
+        {
+            const IPAddress &r = meters[i].remote();
+            w.printf("modbus_meter_requests_expired_total{meter=\"%u.%u.%u.%u\"} %u\n", r[0], r[1], r[2], r[3], meters[i].expired());
+        }
+
+        w.family("modbus_meter_data_age_seconds", "gauge", "Time since the data of a meter block was received");
+        for (uint8_t i = 0; i < number_meters; i++)
+            for (uint16_t b = 0; b < meterBlocks.size(); b++)
+            {
+                const modbus::BlockTiming &t = meters[i]._scheduler.timing(b);
+                if (t._completed == 0)
+                    continue;
+                meterLabel(i, "block", meterBlocks[b]._name);
+                w.printf("modbus_meter_data_age_seconds{%s} %g\n", labels, (now - t._lastCompleted) / 1000.0);
+            }
+
+        modbus::Span<modbus::Block> wattnodeBlocks = modbus::WattNode::getDeviceDescription().blocks();
+        w.family("wattnode_rtu_reads_total", "counter", "Read requests of the inverter per WattNode block");
+        for (uint8_t f = 0; f < number_feeds; f++)
+            for (uint16_t b = 0; b < wattnodeBlocks.size(); b++)
+                w.printf("wattnode_rtu_reads_total{slave=\"%u\",block=\"%s\"} %u\n", feeds[f]._slaveId, wattnodeBlocks[b]._name,
+                         feeds[f]._wattnode._demand.demand(b)._reads);
+
+        w.family("wattnode_rtu_response_cache_total", "counter", "Reads answered with a cached response frame, and reads that needed a new one");
+        w.printf("wattnode_rtu_response_cache_total{result=\"hit\"} %u\n", rtu.cache().hits());
+        w.printf("wattnode_rtu_response_cache_total{result=\"miss\"} %u\n", rtu.cache().misses());
+        w.family("wattnode_rtu_incomplete_frames_total", "counter", "Requests dropped because the line went silent before all their bytes arrived");
+        w.printf("wattnode_rtu_incomplete_frames_total %u\n", rtu.incomplete());
+        w.family("wattnode_rtu_line_errors_total", "counter", "Bytes received on the RS485 bus with a framing or parity error");
+        w.printf("wattnode_rtu_line_errors_total %u\n", rs485.errors());
+        w.family("wattnode_rtu_line_baud", "gauge", "Speed of the RS485 bus");
+        w.printf("wattnode_rtu_line_baud %u\n", unsigned(line.settings()._baud));
+
+        w.family("wattnode_publishes_total", "counter", "Conversions that changed the values served to the inverter");
+        for (uint8_t f = 0; f < number_feeds; f++)
+            w.printf("wattnode_publishes_total{slave=\"%u\"} %u\n", feeds[f]._slaveId, feeds[f]._wattnode.published());
+
+        w.family("wattnode_served_data_age_seconds", "summary", "Age of the meter data when the inverter read it");
+        for (uint8_t f = 0; f < number_feeds; f++)
+            for (uint16_t b = 0; b < wattnodeBlocks.size(); b++)
+            {
+                const modbus::BlockDemand &d = feeds[f]._wattnode._demand.demand(b);
+                if (d._aged == 0)
+                    continue;
+                snprintf(labels, sizeof(labels), "slave=\"%u\",block=\"%s\"", feeds[f]._slaveId, wattnodeBlocks[b]._name);
+                w.printf("wattnode_served_data_age_seconds_sum{%s} %g\n", labels, d._sumAge / 1000.0);
+                w.printf("wattnode_served_data_age_seconds_count{%s} %u\n", labels, d._aged);
+            }
+
+        w.family("gateway_loop_duration_seconds", "histogram", "Time spent in one round of polling the meters and converting, without the wait for the next event");
+        for (uint8_t f = 0; f < number_feeds; f++)
+        {
+            snprintf(labels, sizeof(labels), "slave=\"%u\"", feeds[f]._slaveId);
+            w.histogram("gateway_loop_duration_seconds", labels, feeds[f]._loopTime, 1000000);
+        }
+    }
+    server.sendContent("", 0);
+}
+
+// Show the RS485 settings, or change them: ?baud=19200&parity=even&stopbits=1 fixes them, ?auto=1 detects them
+void handleRs485()
+{
+    modbus::LineDetector::State state = line.state();
+    modbus::LineSettings settings = state._settings;
+    bool automatic = state._automatic;
+    bool change = false;
+    if (server.hasArg("baud"))
+    {
+        String parity = server.arg("parity");
+        settings._baud = server.arg("baud").toInt();
+        settings._parity = parity == "even" ? modbus::Parity::even : parity == "odd" ? modbus::Parity::odd
+                                                                                     : modbus::Parity::none;
+        settings._stopBits = server.hasArg("stopbits") ? server.arg("stopbits").toInt() : 1;
+        automatic = false;
+        change = true;
+    }
+    if (server.hasArg("auto"))
+    {
+        automatic = server.arg("auto") == "1";
+        change = true;
+    }
+    if (change && !settings.valid())
+    {
+        server.send(400, "text/plain", "Invalid settings\r\n");
+        return;
+    }
+    if (change)
+    {
+        preferences.putUInt("line", settings.pack());
+        preferences.putBool("auto", automatic);
+        storedLine = settings.pack();
+        lineCommands.push({settings, automatic});
+    }
+
+    char buf[24];
+    char r[300];
+    snprintf(r, sizeof(r),
+             "RS485 %s, %s\r\nRequests=%u, framing or parity errors=%u, incomplete=%u, detected=%u\r\n"
+             "Fix with ?baud=19200&parity=none|even|odd&stopbits=1|2, detect with ?auto=1\r\n",
+             settings.toString(buf, sizeof(buf)), !automatic ? "fixed" : state._locked && !change ? "detected" : "detecting",
+             rtu.frames(), rs485.errors(), rtu.incomplete(), state._detected);
+    server.send(200, "text/plain", r);
+}
+
+// The recent requests of the inverter, grouped by query
+void handleQueries()
+{
+    String r = rtu.trace().report();
     server.send(200, "text/plain", r.c_str());
 }
 
 void handleWattnode()
 {
-    String r = wattnode.allValueAsString();
+    String r;
+    for (uint8_t f = 0; f < number_feeds; f++)
+    {
+        r += "WattNode " + String(feeds[f]._slaveId) + "\r\n";
+        r += feeds[f]._wattnode.allValueAsString();
+    }
     server.send(200, "text/plain", r.c_str());
 }
 
@@ -99,7 +371,7 @@ void handleDescription()
 {
     String r;
     r += wattnode._dd.GetDescriptions();
-    r += meter._dd.GetDescriptions();
+    r += meters[0]._dd.GetDescriptions();
     server.send(200, "text/plain", r.c_str());
 }
 
@@ -159,6 +431,82 @@ void WiFiEvent(arduino_event_id_t event)
     }
 }
 
+// The inverter is answered by its own task at the highest priority, on the application core where otherwise
+// only loop() runs, so its response time does not depend on the web server or the meters. The meters are polled
+// and converted on the protocol core, next to the network stack, by one task per WattNode. The tasks exchange data without locks: the
+// published register images of the slave, the double buffered block values of the meters and the queue of
+// inverter reads, see slave.h and definitions.h.
+constexpr BaseType_t rtu_core = 1;
+constexpr BaseType_t meter_core = 0;
+constexpr UBaseType_t rtu_priority = configMAX_PRIORITIES - 1;
+constexpr UBaseType_t meter_priority = 5;
+
+// Neither task polls at a fixed rate. The RTU task sleeps until the UART notifies it of the end of a request, the meter
+// task until a meter answers or the next deadline of the meters: a block to release, a request to time out or a
+// connection to retry. The limits only bound the time the tasks sleep when nothing happens.
+constexpr uint32_t rtu_max_wait = 1000;
+constexpr unsigned long meter_max_wait = 100;
+
+void rtuTask(void *)
+{
+    for (;;)
+    {
+        rtu.serve(rtu_max_wait);
+        LineCommand c;
+        while (lineCommands.pop(c))
+        {
+            rs485.configure(c._settings);
+            line.begin(c._settings, c._automatic, millis(), rtu.frames(), rs485.errors());
+        }
+        if (line.poll(millis(), rtu.frames(), rs485.errors()))
+            rs485.configure(line.settings());
+    }
+}
+
+void meterTask(void *parameter)
+{
+    Feed &feed = *static_cast<Feed *>(parameter);
+    // The conversion reports its own allocations, not those of the network stack meanwhile
+    modbus::countAllocations();
+    uint8_t first = feed._first;
+    uint8_t last = first + feed._meter.size();
+    for (;;)
+    {
+        unsigned long start = micros();
+
+        // Each meter reads the blocks that are due according to the schedule of the EM24 (see em24.h), earliest
+        // deadline first. Nearby blocks are combined in one request.
+        // Once the inverter reads, only the blocks it needs are read, at a rate derived from how often it reads them.
+        feed._converter.ScheduleFromDemand(millis());
+        // The Modbus Master object tends to return timeouts if creating too many requests and not giving time to process them
+        // Hence the meter object limits the number of outstanding requests to a window that grows while the meter
+        // answers promptly and shrinks on timeouts.
+        // Send as many requests as the in-flight window of each meter allows. The meters are polled at the same time,
+        // so adding a meter does not add to the refresh time.
+        for (uint8_t i = first; i < last; i++)
+            meters[i].readPendingFromMeter();
+        // process tcp tasks
+        for (uint8_t i = first; i < last; i++)
+            tcp[i].task();
+
+        // Received data from a meter and it is now stored in the meter object
+        // Combine the meters and copy and convert this data to the wattnode object
+        if (feed._meter.takeDataRead())
+        {
+            feed._converter.CopyDataFromMasterToSlave();
+#ifdef MODBUS_ALLOC_COUNTER
+            if (feed._converter._allocations > 0)
+                Serial.printf("WARNING: conversion performed %u heap allocations\r\n", feed._converter._allocations);
+#endif
+        }
+
+        feed._loopTime.observe(micros() - start);
+
+        // The inverter reads are taken from the queue on the next round, at the latest after meter_max_wait
+        feed._meter.wait(meter_max_wait);
+    }
+}
+
 void setup()
 {
     Serial.begin(115200);
@@ -215,35 +563,38 @@ void setup()
     server.on("/", handleRoot);
     server.on("/description", handleDescription);
     server.on("/meter", handleMeter);
+    server.on("/schedule", handleSchedule);
     server.on("/wattnode", handleWattnode);
+    server.on("/metrics", handleMetrics);
+    server.on("/rs485", handleRs485);
+    server.on("/queries", handleQueries);
     server.onNotFound(handleNotFound);
 
     server.begin();
     Serial.println("HTTP server started");
-    tcp.client();
-    bool val = tcp.connect(remote(), 502);
-    Serial.print("tcp.connect=");
-    Serial.println(val);
-
-    // Setup timers to allow tracking elapsed time
-    prevTime1 = millis() - 5000; // trigger timers immediately at startup
-    prevTime2 = prevTime1;
-    prevTime3 = prevTime1;
-
-    // Start the 485 serial bus
-    Serial485.begin(9600, SERIAL_8N1, BOARD_485_RX, BOARD_485_TX);
-
-#if defined(ESP32) || defined(ESP8266)
-    rtu.begin(&Serial485);
-#else
-    rtu.begin(&Serial485);
-    // rtu.begin(&Serial, RXTX_PIN);  //or use RX/TX direction control pin (if required)
-    rtu.setBaudrate(9600);
+    // The meters connect from the loop, without blocking it when a meter is unreachable
+    for (uint8_t i = 0; i < number_meters; i++)
+        tcp[i].begin();
+
+    // Start the 485 serial bus, on the settings kept in NVS, by default 9600 8N1
+    preferences.begin("rs485", false);
+    modbus::LineSettings settings = modbus::LineSettings::unpack(preferences.getUInt("line", modbus::LineSettings().pack()));
+    if (!settings.valid())
+        settings = modbus::LineSettings();
+    storedLine = settings.pack();
+    Serial485.begin(settings._baud, modbus::serialConfig(settings), BOARD_485_RX, BOARD_485_TX);
+    rs485.begin(&Serial485, UART485, settings);
+    line.begin(settings, preferences.getBool("auto", false), millis(), rtu.frames(), rs485.errors());
+
+#ifdef SLAVE2_ID
+    // The register defaults are those of the first WattNode
+    wattnode2.setValue(modbus::WattNode::modbus_address, modbus::Value::_int16_t(SLAVE2_ID));
+    wattnode2.setValue(modbus::WattNode::serial_number, modbus::Value::_uint32_t(SLAVE2_SERIAL_NUMBER));
 #endif
 
     // Print the setup of the modbus devices
     Serial.print(wattnode._dd.GetDescriptions());
-    Serial.print(meter._dd.GetDescriptions());
+    Serial.print(meters[0]._dd.GetDescriptions());
 
     // OTA
     ArduinoOTA.setHostname(DEVICENAME);
@@ -275,60 +626,28 @@ void setup()
     Serial.print("FlashSize = ");
     Serial.print(ESP.getFlashChipSize());
     Serial.println("bytes.");
+
+    xTaskCreatePinnedToCore(rtuTask, "rtu", 4096, nullptr, rtu_priority, nullptr, rtu_core);
+    for (uint8_t f = 0; f < number_feeds; f++)
+        xTaskCreatePinnedToCore(meterTask, "meters", 8192, &feeds[f], meter_priority, nullptr, meter_core);
 }
 
+// HTTP and OTA, at the lowest priority
 void loop()
 {
-
-    // The Modbus Master object tends to return timeouts if creating too many requests and not giving time to process them
-    // Hence only create one request per loop with a following 20 ms delay
-    // To implement this, a static _joblist is maintained. You can add blocks to be retrieved and
-    // they will be processed one at a time.
-    static std::queue<String> _joblist;
-
     // check for updates
     ArduinoOTA.handle();
 
     // Handle HTTP requests
     server.handleClient();
 
-    // use elapsed time to know when to add a new job
-    unsigned long currTime = millis();
-    if (currTime - prevTime1 >= 500) // Instantaneous variables, update regularly
-    {
-        _joblist.push("dynamic");
-        prevTime1 = currTime;
-    }
-    if (currTime - prevTime2 >= 1000) // Updated every second
-    {
-        _joblist.push("energy");
-        prevTime2 = currTime;
-    }
-    if (currTime - prevTime3 >= 4700)
-    { // This hardly ever changes
-        _joblist.push("time");
-        _joblist.push("tariff");
-        prevTime3 = currTime;
-    }
-    // process only one job per loop to avoid timeouts
-    if (_joblist.size() > 0)
-    {
-        String b = _joblist.front();
-        _joblist.pop();
-        meter.readBlockFromMeter(b);
-    }
-    // process tcp and rtu tasks
-    tcp.task();
-    rtu.task();
-
-    // Received data from the meter and it is now stored in the meter object
-    // Copy and convert this data to the wattnode object
-    if (meter._dataRead)
+    // Keep detected settings, the next start begins with them
+    modbus::LineDetector::State state = line.state();
+    if (state._automatic && state._locked && state._settings.pack() != storedLine)
     {
-        converter.CopyDataFromMasterToSlave();
-        meter._dataRead = false;
+        storedLine = state._settings.pack();
+        preferences.putUInt("line", storedLine);
     }
 
-    // delay 20 miliseconds to allow background tasks to finish
     delay(20); // allow the cpu to switch to other tasks
-}
\ No newline at end of file
+}
@@ -0,0 +1,139 @@
+/**
+ * @file      Arduino.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      The part of the Arduino API the gateway logic uses, for building it on a POSIX host ([env:native])
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <arpa/inet.h>
+
+using std::lround;
+using std::round;
+
+#define IRAM_ATTR
+
+class String : public std::string
+{
+public:
+    String() = default;
+    String(const char *s) : std::string(s ? s : "") {}
+    String(const std::string &s) : std::string(s) {}
+};
+
+class HostSerial
+{
+public:
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+    void print(const char *s)
+    {
+        fputs(s, stdout);
+    }
+    void print(const String &s)
+    {
+        fputs(s.c_str(), stdout);
+    }
+    void println(const char *s = "")
+    {
+        puts(s);
+    }
+};
+inline HostSerial Serial;
+
+#ifdef SIMULATED_CLOCK
+// The simulations in native/bench run minutes of traffic in a moment: the clock only advances on delay() and
+// advanceMicros(), and the random numbers repeat from run to run
+inline unsigned long simulatedMicros = 0;
+inline unsigned long micros()
+{
+    return simulatedMicros;
+}
+inline void advanceMicros(unsigned long us)
+{
+    simulatedMicros += us;
+}
+inline void delay(unsigned long ms)
+{
+    advanceMicros(ms * 1000);
+}
+inline uint32_t esp_random()
+{
+    static std::mt19937 generator(1);
+    return generator();
+}
+#else
+inline unsigned long micros()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+inline void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+inline uint32_t esp_random()
+{
+    static std::mt19937 generator(std::random_device{}());
+    return generator();
+}
+#endif
+inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+// IPv4 address, the bytes in network order like on the ESP32
+class IPAddress
+{
+public:
+    IPAddress() = default;
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{a, b, c, d} {}
+    bool fromString(const char *address)
+    {
+        return inet_pton(AF_INET, address, _bytes) == 1;
+    }
+    String toString() const
+    {
+        char buf[16];
+        sprintf(buf, "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+        return buf;
+    }
+    uint8_t operator[](int i) const
+    {
+        return _bytes[i];
+    }
+    operator uint32_t() const
+    {
+        uint32_t a;
+        memcpy(&a, _bytes, sizeof(a));
+        return a;
+    }
+    bool operator==(const IPAddress &other) const
+    {
+        return uint32_t(*this) == uint32_t(other);
+    }
+
+private:
+    uint8_t _bytes[4] = {0, 0, 0, 0};
+};
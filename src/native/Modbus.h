@@ -0,0 +1,89 @@
+/**
+ * @file      Modbus.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      The types of the modbus-esp8266 library the gateway logic uses, for building it on a POSIX host
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// Same value as the library, see ModbusSettings.h of modbus-esp8266
+#define MODBUSIP_TIMEOUT 1000
+
+struct TAddress
+{
+    enum RegType
+    {
+        COIL,
+        ISTS,
+        IREG,
+        HREG,
+        NONE = 0xFF
+    };
+    RegType type;
+    uint16_t address;
+};
+
+inline TAddress HREG(uint16_t offset)
+{
+    return {TAddress::HREG, offset};
+}
+
+class Modbus
+{
+public:
+    enum FunctionCode
+    {
+        FC_READ_COILS = 0x01,
+        FC_READ_INPUT_STAT = 0x02,
+        FC_READ_REGS = 0x03,
+        FC_READ_INPUT_REGS = 0x04,
+        FC_WRITE_COIL = 0x05,
+        FC_WRITE_REG = 0x06,
+        FC_DIAGNOSTICS = 0x08,
+        FC_WRITE_COILS = 0x0F,
+        FC_WRITE_REGS = 0x10,
+        FC_READWRITE_REGS = 0x17
+    };
+    enum ResultCode
+    {
+        EX_SUCCESS = 0x00,
+        EX_ILLEGAL_FUNCTION = 0x01,
+        EX_ILLEGAL_ADDRESS = 0x02,
+        EX_ILLEGAL_VALUE = 0x03,
+        EX_SLAVE_FAILURE = 0x04,
+        EX_ACKNOWLEDGE = 0x05,
+        EX_SLAVE_DEVICE_BUSY = 0x06,
+        EX_MEMORY_PARITY_ERROR = 0x08,
+        EX_PATH_UNAVAILABLE = 0x0A,
+        EX_DEVICE_FAILED_TO_RESPOND = 0x0B,
+        EX_GENERAL_FAILURE = 0xE1,
+        EX_DATA_MISMACH = 0xE2,
+        EX_UNEXPECTED_RESPONSE = 0xE3,
+        EX_TIMEOUT = 0xE4,
+        EX_CONNECTION_LOST = 0xE5,
+        EX_CANCEL = 0xE6,
+        EX_PASSTHROUGH = 0xE7,
+        EX_FORCE_PROCESS = 0xE8
+    };
+    // Same members and constructors as the library, see Modbus.h of modbus-esp8266
+    struct RequestData
+    {
+        TAddress reg;
+        uint16_t regCount;
+        TAddress regRead = {TAddress::NONE, 0};
+        uint16_t regReadCount = 0;
+        RequestData(TAddress r1, uint16_t c1) : reg(r1), regCount(c1)
+        {
+        }
+        RequestData(TAddress r1, uint16_t c1, TAddress r2, uint16_t c2) : reg(r1), regCount(c1), regRead(r2), regReadCount(c2)
+        {
+        }
+    };
+};
+
+typedef std::function<bool(Modbus::ResultCode, uint16_t, void *)> cbTransaction;
+typedef std::function<Modbus::ResultCode(Modbus::FunctionCode, const Modbus::RequestData)> cbRequest;
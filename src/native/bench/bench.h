@@ -0,0 +1,39 @@
+/**
+ * @file      bench.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Timing helpers for the host benchmarks ([env:bench_*] in platformio.ini)
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <chrono>
+
+namespace bench
+{
+    // Keep the compiler from dropping a result or moving work out of the timed loop
+    template <typename T>
+    inline void keep(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Time f called repeat times, best of runs, in ns per call. The best run is the one least disturbed by the host.
+    template <typename F>
+    double nanos(uint32_t repeat, F f, uint8_t runs = 15)
+    {
+        double best = 0;
+        for (uint8_t run = 0; run < runs; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < repeat; i++)
+                f();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / repeat;
+            if (run == 0 || ns < best)
+                best = ns;
+        }
+        return best;
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * @file      decode.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host benchmark of decoding the EM24 registers to float, over every register of its description.
+ *            Per register, or per block into the float snapshot of BlockValues as the meters do on arrival.
+ */
+#include <Arduino.h>
+#include "bench.h"
+#include "definitions.h"
+#include "em24.h"
+
+using namespace modbus;
+
+// The decode as it was before the decoders: a switch on the type, the scaling looked up and rounded to, then
+// divided by the scaling again by the caller
+static float switchToFloat32(const Register &r, const uint16_t *words)
+{
+    float result = 0;
+    Value v;
+    switch (r._dataType)
+    {
+    case float32:
+        v.w1 = words[0];
+        v.w2 = words[1];
+        result = round(float(v.f32) * getScaling(r._scaling)) / getScaling(r._scaling);
+        break;
+    case int16:
+        v.w1 = words[0];
+        result = round(float(v.i16) * getScaling(r._scaling)) / getScaling(r._scaling);
+        break;
+    case uint16:
+        v.w1 = words[0];
+        result = round(float(v.ui16) * getScaling(r._scaling)) / getScaling(r._scaling);
+        break;
+    case int32:
+        v.w1 = words[0];
+        v.w2 = words[1];
+        result = round(float(v.i32) * getScaling(r._scaling)) / getScaling(r._scaling);
+        break;
+    case uint32:
+        v.w1 = words[0];
+        v.w2 = words[1];
+        result = round(float(v.ui32) * getScaling(r._scaling)) / getScaling(r._scaling);
+        break;
+    }
+    return result / getScaling(r._scaling);
+}
+
+int main()
+{
+    constexpr const DeviceDescription<EM24> &dd = EM24::getDeviceDescription();
+    constexpr uint16_t number_words = dd.numberWords();
+    constexpr uint32_t repeat = 20000;
+
+    // Raw words of all blocks as a meter could send them, float32 registers get a valid float
+    uint16_t words[number_words];
+    uint32_t seed = 12345;
+    for (uint16_t w = 0; w < number_words; w++)
+    {
+        seed = seed * 1103515245 + 12345;
+        words[w] = seed >> 16;
+    }
+    const Register *registers[DeviceDescription<EM24>::number_registers];
+    const uint16_t *raw[DeviceDescription<EM24>::number_registers];
+    uint16_t number_registers = 0;
+    for (uint16_t b = 0; b < dd.number_blocks; b++)
+    {
+        const Block &block = dd.blocks()[b];
+        for (auto r = dd.registers(block).begin(); r < dd.registers(block).end(); r++)
+        {
+            uint16_t *w = words + dd.firstWord(b) + r->_offset - block._offset;
+            if (r->_dataType == float32)
+            {
+                Value v;
+                v.f32 = float(w[0]) / 7;
+                w[0] = v.w1;
+                w[1] = v.w2;
+            }
+            registers[number_registers] = &*r;
+            raw[number_registers++] = w;
+        }
+    }
+
+    // All decodes have to give the same values
+    uint16_t differ = 0;
+    for (uint16_t i = 0; i < number_registers; i++)
+    {
+        float a = switchToFloat32(*registers[i], raw[i]);
+        float b = getDecoder(registers[i]->_decoder)(raw[i]);
+        if (std::fabs(a - b) > 1e-6f * std::max(1.0f, std::fabs(a)))
+            differ++;
+    }
+
+    // The blocks as the meter task keeps them, decoded on arrival with decodeRun
+    std::vector<BlockValues> blocks;
+    for (uint16_t b = 0; b < dd.number_blocks; b++)
+        blocks.emplace_back(dd.blocks()[b], dd.registers(dd.blocks()[b]));
+    for (uint16_t b = 0; b < dd.number_blocks; b++)
+        blocks[b].update(words + dd.firstWord(b), 0);
+    for (uint16_t b = 0, i = 0; b < dd.number_blocks; b++)
+    {
+        for (uint16_t r = 0; r < blocks[b]._registers.size(); r++, i++)
+        {
+            if (blocks[b].getFloatValue(r) != getDecoder(registers[i]->_decoder)(raw[i]))
+                differ++;
+        }
+    }
+
+    double before = bench::nanos(repeat, [&]()
+                                 {
+        for (uint16_t i = 0; i < number_registers; i++)
+            bench::keep(switchToFloat32(*registers[i], raw[i])); });
+    double after = bench::nanos(repeat, [&]()
+                                {
+        for (uint16_t i = 0; i < number_registers; i++)
+            bench::keep(getDecoder(registers[i]->_decoder)(raw[i])); });
+    double update = bench::nanos(repeat, [&]()
+                                 {
+        for (uint16_t b = 0; b < dd.number_blocks; b++)
+            blocks[b].update(words + dd.firstWord(b), 0); });
+    double reads = bench::nanos(repeat, [&]()
+                                {
+        for (uint16_t b = 0; b < dd.number_blocks; b++)
+            for (uint16_t r = 0; r < blocks[b]._registers.size(); r++)
+                bench::keep(blocks[b].getFloatValue(r)); });
+
+    Serial.printf("EM24, %u registers in %u blocks, %u values differ\r\n", number_registers, dd.number_blocks, differ);
+    Serial.printf("switch on the type, round and divide: %6.2f ns/register\r\n", before / number_registers);
+    Serial.printf("decoder per register:                 %6.2f ns/register\r\n", after / number_registers);
+    Serial.printf("blocks decoded with decodeRun:        %6.2f ns/register\r\n", update / number_registers);
+    Serial.printf("reads of the decoded blocks:          %6.2f ns/register\r\n", reads / number_registers);
+    return 0;
+}
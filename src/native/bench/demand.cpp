@@ -0,0 +1,94 @@
+/**
+ * @file      demand.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host simulation of the meter reads a SolarEdge inverter causes, with the fixed schedule of the EM24 and
+ *            with the schedule derived from the reads of the inverter (ConvertEM24ToWattNode::ScheduleFromDemand), and
+ *            of the age of the instantaneous values the inverter gets
+ */
+#include <Arduino.h>
+#include "simulation.h"
+#include "master.h"
+#include "slave.h"
+#include "em24.h"
+#include "wattnode.h"
+#include "meter_aggregate.h"
+#include "convert_em24_to_wattnode.h"
+
+using namespace modbus;
+
+// The queries of the inverter logged in wattnode.h: 1010x6 every second, each followed by one of these or nothing
+struct Query
+{
+    uint16_t _offset;
+    uint16_t _count;
+};
+static constexpr Query queries[] = {{1600, 23}, {1700, 23}, {1736, 2}, {1600, 23}, {1650, 6}, {0, 0}, {0, 0}, {1700, 23}, {1000, 34}, {0, 0}};
+
+// 120 s of inverter queries, the first one phase ms after the start. The meter task is woken up like
+// MeterAggregate::wait does: at the next event of the Master, the next response of the meter or the next query.
+static void run(bool demand, unsigned long phase)
+{
+    constexpr unsigned long duration = 120000000;
+    constexpr uint8_t slave_id = 2;
+    simulatedMicros = 0;
+    bench::SimulatedMeter meter((bench::MeterModel()));
+    Master<EM24> master(meter, IPAddress(127, 0, 0, 1), meter.port());
+    int8_t sign = 1;
+    MeterAggregate<EM24> aggregate(&master, &sign, 1);
+    bench::SimulatedInverter inverter;
+    Slave<WattNode> wattnode(inverter, slave_id);
+    ConvertEM24ToWattNode converter(aggregate, wattnode);
+
+    std::mt19937 random(1);
+    unsigned long nextQuery = 3000000 + phase * 1000;
+    uint32_t query = 0;
+    while (micros() < duration)
+    {
+        if ((long)(micros() - nextQuery) >= 0)
+        {
+            inverter.read(slave_id, 1010, 6);
+            const Query &q = queries[query++ % (sizeof(queries) / sizeof(queries[0]))];
+            if (q._count > 0)
+                inverter.read(slave_id, q._offset, q._count);
+            nextQuery += 1000000 - 30000 + random() % 60001;
+        }
+        if (demand)
+            converter.ScheduleFromDemand(millis());
+        else
+            wattnode.takeReads();
+        master.readPendingFromMeter();
+        meter.task();
+        if (aggregate.takeDataRead())
+            converter.CopyDataFromMasterToSlave();
+
+        unsigned long wait = std::min(master.nextEvent(millis(), 100) * 1000, meter.nextResponse(100000));
+        wait = std::min(wait, (unsigned long)std::max(long(nextQuery - micros()), 0l));
+        // The loop itself
+        advanceMicros(std::max(wait, 200ul));
+    }
+
+    const BlockDemand &d = wattnode._demand.demand(WattNode::block1000);
+    Serial.printf("%-14s phase %3lu ms: %3u meter requests, %5u registers, age of 1000 at the query mean %3lu ms max %4lu ms\r\n",
+                  demand ? "demand driven" : "fixed schedule", phase, meter._requests, meter._registers,
+                  d._aged > 0 ? d._sumAge / d._aged : 0, d._maxAge);
+    if (phase == 0)
+    {
+        for (uint16_t b = 0; b < EM24::last_block; b++)
+            Serial.printf("  EM24 %-8s read %3u times\r\n", EM24::getDeviceDescription().blocks()[b]._name,
+                          master._scheduler.timing(b)._completed);
+    }
+}
+
+int main()
+{
+    // The phase of the inverter against the fixed schedule of 500 ms matters, the phase locked read should not care
+    for (bool demand : {false, true})
+    {
+        for (unsigned long phase = 0; phase < 500; phase += 100)
+            run(demand, phase);
+    }
+    return 0;
+}
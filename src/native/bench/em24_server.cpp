@@ -0,0 +1,209 @@
+/**
+ * @file      em24_server.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Simulated EM24s for measuring the native gateway in real time: Modbus TCP servers on 127.0.0.1 that
+ *            answer reads of input registers with the address as the value of every register
+ */
+#include <Arduino.h>
+#include <algorithm>
+#include <csignal>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// Usage: em24_server [-d delay] port [port ...]
+//   -d delay  ms the meter takes for each request, one after the other like the serial EM24, default 10
+//   port      an EM24 on 127.0.0.1:port, e.g. 1502 1503 for the two meters of the native gateway
+// Stops on SIGINT or SIGTERM and prints the number of requests per meter.
+
+static volatile sig_atomic_t running = 1;
+static void stop(int)
+{
+    running = 0;
+}
+
+static unsigned long now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ul + t.tv_nsec / 1000;
+}
+
+struct Connection
+{
+    int _fd;
+    size_t _meter;
+    std::vector<uint8_t> _rx;
+};
+
+// A response waiting for the simulated meter to finish
+struct Response
+{
+    unsigned long _due;
+    int _fd;
+    std::vector<uint8_t> _frame;
+};
+
+struct Meter
+{
+    uint16_t _port;
+    int _listener;
+    unsigned long _free;
+    uint32_t _requests;
+};
+
+static std::vector<uint8_t> respond(const uint8_t *request)
+{
+    uint8_t fc = request[7];
+    uint16_t address = (request[8] << 8) | request[9];
+    uint16_t count = (request[10] << 8) | request[11];
+    std::vector<uint8_t> frame(request, request + 8);
+    if (fc != 0x04 || count == 0 || count > 125)
+    {
+        frame[7] = fc | 0x80;
+        frame.push_back(fc != 0x04 ? 0x01 : 0x03);
+    }
+    else
+    {
+        frame.push_back(2 * count);
+        for (uint16_t i = 0; i < count; i++)
+        {
+            frame.push_back((address + i) >> 8);
+            frame.push_back((address + i) & 0xff);
+        }
+    }
+    uint16_t length = frame.size() - 6;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = length >> 8;
+    frame[5] = length & 0xff;
+    return frame;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long delay = 10000;
+    std::vector<Meter> meters;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            delay = atof(argv[++i]) * 1000;
+        else if (atoi(argv[i]) > 0)
+            meters.push_back({uint16_t(atoi(argv[i])), -1, 0, 0});
+        else
+        {
+            Serial.printf("Usage: %s [-d delay] port [port ...]\r\n", argv[0]);
+            return 1;
+        }
+    }
+    if (meters.empty())
+    {
+        Serial.printf("Usage: %s [-d delay] port [port ...]\r\n", argv[0]);
+        return 1;
+    }
+    for (auto m = meters.begin(); m < meters.end(); m++)
+    {
+        m->_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int one = 1;
+        setsockopt(m->_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(m->_port);
+        if (bind(m->_listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m->_listener, 4) < 0)
+        {
+            Serial.printf("ERROR: can not listen on port %u\r\n", m->_port);
+            return 1;
+        }
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Connection> connections;
+    std::vector<Response> responses;
+    while (running)
+    {
+        fd_set readable;
+        FD_ZERO(&readable);
+        int last = -1;
+        for (auto m = meters.begin(); m < meters.end(); m++)
+        {
+            FD_SET(m->_listener, &readable);
+            last = std::max(last, m->_listener);
+        }
+        for (auto c = connections.begin(); c < connections.end(); c++)
+        {
+            FD_SET(c->_fd, &readable);
+            last = std::max(last, c->_fd);
+        }
+        unsigned long wait = 100000;
+        unsigned long t = now();
+        for (auto r = responses.begin(); r < responses.end(); r++)
+            wait = std::min(wait, (unsigned long)std::max(long(r->_due - t), 0l));
+        struct timeval tv = {long(wait / 1000000), long(wait % 1000000)};
+        if (select(last + 1, &readable, nullptr, nullptr, &tv) < 0)
+            continue;
+
+        for (auto m = meters.begin(); m < meters.end(); m++)
+        {
+            if (!FD_ISSET(m->_listener, &readable))
+                continue;
+            int fd = accept(m->_listener, nullptr, nullptr);
+            if (fd >= 0)
+                connections.push_back({fd, size_t(m - meters.begin()), {}});
+        }
+        t = now();
+        for (auto c = connections.begin(); c < connections.end();)
+        {
+            if (FD_ISSET(c->_fd, &readable))
+            {
+                uint8_t buf[512];
+                ssize_t n = read(c->_fd, buf, sizeof(buf));
+                if (n <= 0)
+                {
+                    int fd = c->_fd;
+                    responses.erase(std::remove_if(responses.begin(), responses.end(), [fd](const Response &r)
+                                                   { return r._fd == fd; }),
+                                    responses.end());
+                    close(fd);
+                    c = connections.erase(c);
+                    continue;
+                }
+                c->_rx.insert(c->_rx.end(), buf, buf + n);
+                // Whole requests: MBAP header, function code, address and count
+                while (c->_rx.size() >= 12)
+                {
+                    Meter &m = meters[c->_meter];
+                    m._free = std::max(m._free, t) + delay;
+                    m._requests++;
+                    responses.push_back({m._free, c->_fd, respond(c->_rx.data())});
+                    c->_rx.erase(c->_rx.begin(), c->_rx.begin() + 12);
+                }
+            }
+            c++;
+        }
+        // Responses are due in the order they were queued per meter
+        for (auto r = responses.begin(); r < responses.end();)
+        {
+            if ((long)(t - r->_due) < 0)
+            {
+                r++;
+                continue;
+            }
+            if (write(r->_fd, r->_frame.data(), r->_frame.size()) != ssize_t(r->_frame.size()))
+                Serial.printf("ERROR: response of %u bytes not written\r\n", unsigned(r->_frame.size()));
+            r = responses.erase(r);
+        }
+    }
+
+    for (auto m = meters.begin(); m < meters.end(); m++)
+        Serial.printf("EM24 on port %u: %u requests\r\n", m->_port, m->_requests);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file      inverter.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Simulated SolarEdge inverter for measuring the native gateway in real time: reads the WattNode blocks
+ *            over the pseudo terminal, checks the responses and reports the time to each response
+ */
+#include <Arduino.h>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "rtu_server.h"
+
+// Usage: inverter [-s slave] [-b baud] [-i interval] [-t seconds] link
+//   -s slave     WattNode to read, default SLAVE_ID
+//   -b baud      speed of the bus, like -b of the gateway. The request goes out one character of 11 bits at a time, and
+//                the gateway can only answer after the silent time that ends it (interframeMicros). Default 9600
+//   -i interval  ms between the rounds of reads, default 50
+//   -t seconds   duration, default 30
+//   link         the pseudo terminal of the gateway, see its -l
+// Every round reads 1010x6, 1000x34 and 1100x34. Prints the number of valid and bad responses and the percentiles of
+// the time from the last byte of a request to the last byte of its response, also above the silent time. Requests this
+// host split by pausing for the silent time are counted apart. Exits with 1 if a response was bad.
+
+static unsigned long now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000ul + t.tv_nsec / 1000;
+}
+
+// Read holding registers, returns the us until the complete response, 0 if it was bad or did not come in 1 s, and -1
+// if this host paused between two bytes of the request for the silent time, which ends a frame on the bus.
+static long read(int fd, uint8_t slave, uint16_t offset, uint16_t count, unsigned long character, unsigned long silent)
+{
+    uint8_t request[8] = {slave, 0x03, uint8_t(offset >> 8), uint8_t(offset), uint8_t(count >> 8), uint8_t(count)};
+    uint16_t crc = modbus::crc16(request, 6);
+    request[6] = crc & 0xff;
+    request[7] = crc >> 8;
+    tcflush(fd, TCIFLUSH);
+    // A pseudo terminal passes the bytes at once, on the bus they follow each other at the speed of the line
+    unsigned long start = now();
+    unsigned long sent = start;
+    bool split = false;
+    for (size_t i = 0; i < sizeof(request); i++)
+    {
+        while ((long)(now() - start - i * character) < 0)
+            usleep(std::min(character, 100ul));
+        if (write(fd, &request[i], 1) != 1)
+            return 0;
+        split |= now() - sent >= silent;
+        sent = now();
+    }
+    start = sent;
+
+    uint8_t response[5 + 2 * 125];
+    size_t expected = 5 + 2 * count;
+    size_t length = 0;
+    while (length < expected)
+    {
+        long left = 1000000 - long(now() - start);
+        struct pollfd p = {fd, POLLIN, 0};
+        if (left <= 0 || ::poll(&p, 1, left / 1000 + 1) <= 0)
+            return split ? -1 : 0;
+        ssize_t n = ::read(fd, response + length, sizeof(response) - length);
+        if (n > 0)
+            length += n;
+        // An exception response is complete after 5 bytes
+        if (length >= 5 && (response[1] & 0x80))
+            return split ? -1 : 0;
+    }
+    unsigned long elapsed = now() - start;
+    crc = response[expected - 2] | (response[expected - 1] << 8);
+    bool valid = length == expected && response[0] == slave && response[1] == 0x03 && response[2] == 2 * count &&
+                 modbus::crc16(response, expected - 2) == crc;
+    if (split)
+        return -1;
+    return valid ? std::max(elapsed, 1ul) : 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t slave = SLAVE_ID;
+    uint32_t baud = 9600;
+    unsigned long interval = 50;
+    unsigned long seconds = 30;
+    const char *link = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            slave = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            baud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            seconds = atoi(argv[++i]);
+        else if (link == nullptr && argv[i][0] != '-')
+            link = argv[i];
+        else
+        {
+            link = nullptr;
+            break;
+        }
+    }
+    if (link == nullptr || baud == 0)
+    {
+        Serial.printf("Usage: %s [-s slave] [-b baud] [-i interval] [-t seconds] link\r\n", argv[0]);
+        return 1;
+    }
+    int fd = open(link, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        Serial.printf("ERROR: can not open %s\r\n", link);
+        return 1;
+    }
+    struct termios t;
+    tcgetattr(fd, &t);
+    cfmakeraw(&t);
+    tcsetattr(fd, TCSANOW, &t);
+
+    struct Read
+    {
+        uint16_t _offset;
+        uint16_t _count;
+    };
+    constexpr Read reads[] = {{1010, 6}, {1000, 34}, {1100, 34}};
+    unsigned long character = 11000000 / baud;
+    unsigned long silent = modbus::interframeMicros(baud);
+    std::vector<unsigned long> latencies;
+    uint32_t bad = 0;
+    uint32_t split = 0;
+    unsigned long end = now() + seconds * 1000000;
+    while ((long)(now() - end) < 0)
+    {
+        for (const Read &r : reads)
+        {
+            long l = read(fd, slave, r._offset, r._count, character, silent);
+            if (l > 0)
+                latencies.push_back(l);
+            else if (l < 0)
+                split++;
+            else
+                bad++;
+        }
+        usleep(interval * 1000);
+    }
+    close(fd);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](unsigned p)
+    { return latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, latencies.size() * p / 100)] / 1000.0; };
+    Serial.printf("WattNode %u: %u valid responses, %u bad, latency p50 %.2f ms p90 %.2f ms p99 %.2f ms max %.2f ms\r\n", slave,
+                  unsigned(latencies.size()), bad, percentile(50), percentile(90), percentile(99),
+                  latencies.empty() ? 0 : latencies.back() / 1000.0);
+    Serial.printf("  %u baud, silent time %.2f ms: above it p50 %.2f ms p90 %.2f ms p99 %.2f ms, %u requests split by this host\r\n",
+                  baud, silent / 1000.0, percentile(50) - silent / 1000.0, percentile(90) - silent / 1000.0,
+                  percentile(99) - silent / 1000.0, split);
+    return bad > 0 ? 1 : 0;
+}
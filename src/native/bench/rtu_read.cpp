@@ -0,0 +1,206 @@
+/**
+ * @file      rtu_read.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host benchmark of answering the holding register reads of the inverter, request frame in, response
+ *            frame out, CRC included
+ */
+#include <Arduino.h>
+#include <vector>
+#include "bench.h"
+#include "rtu_server.h"
+#include "slave.h"
+#include "wattnode.h"
+
+using namespace modbus;
+
+// Hands the server one request at a time and keeps the response
+class BenchLink : public SerialLink
+{
+public:
+    void request(const uint8_t *frame, size_t length)
+    {
+        memcpy(_rx, frame, length);
+        _rxLength = length;
+    }
+    bool wait(uint32_t) override
+    {
+        return true;
+    }
+    size_t read(uint8_t *data, size_t length) override
+    {
+        size_t n = std::min(length, _rxLength);
+        memcpy(data, _rx, n);
+        _rxLength = 0;
+        return n;
+    }
+    bool write(const uint8_t *data, size_t length) override
+    {
+        _tx.assign(data, data + length);
+        return true;
+    }
+    const char *name() const override
+    {
+        return "bench";
+    }
+    bool configure(const LineSettings &) override
+    {
+        return true;
+    }
+    uint32_t errors() const override
+    {
+        return 0;
+    }
+    std::vector<uint8_t> _tx;
+
+private:
+    uint8_t _rx[16];
+    size_t _rxLength = 0;
+};
+
+// Registers the slave without its version callback, so every read is built from the register image
+class WithoutCache : public ServerTransport
+{
+public:
+    WithoutCache(ServerTransport &server) : _server(server)
+    {
+    }
+    bool slave(uint8_t slaveId, cbRequest request, cbReadHregs read, cbWriteHregs write, cbHregsVersion) override
+    {
+        return _server.slave(slaveId, request, read, write, nullptr);
+    }
+    void task() override
+    {
+        _server.task();
+    }
+
+private:
+    ServerTransport &_server;
+};
+
+// The server as it was before the register image: a list with an entry per register word, searched for every
+// word of a request, once to check the range and once to read it. Like ModbusRTU does on the ESP32.
+class RegisterList
+{
+public:
+    RegisterList(uint8_t slaveId) : _slaveId(slaveId)
+    {
+        const DeviceDescription<WattNode> &dd = WattNode::getDeviceDescription();
+        for (auto b = dd.blocks().begin(); b < dd.blocks().end(); b++)
+        {
+            for (auto r = dd.registers(*b).begin(); r < dd.registers(*b).end(); r++)
+            {
+                _registers.push_back({r->_offset, r->_default.w1});
+                if (r->_number == 2)
+                    _registers.push_back({uint16_t(r->_offset + 1), r->_default.w2});
+            }
+        }
+    }
+    const std::vector<uint8_t> &answer(const uint8_t *f, size_t length)
+    {
+        _tx.clear();
+        uint16_t crc = f[length - 2] | (f[length - 1] << 8);
+        if (f[0] != _slaveId || crc != crc16(f, length - 2))
+            return _tx;
+        uint16_t address = (f[2] << 8) | f[3];
+        uint16_t count = (f[4] << 8) | f[5];
+        bool held = true;
+        for (uint16_t r = 0; held && r < count; r++)
+            held = find(address + r) != nullptr;
+        _tx.push_back(_slaveId);
+        if (!held)
+        {
+            _tx.push_back(f[1] | 0x80);
+            _tx.push_back(Modbus::EX_ILLEGAL_ADDRESS);
+        }
+        else
+        {
+            _tx.push_back(f[1]);
+            _tx.push_back(2 * count);
+            for (uint16_t r = 0; r < count; r++)
+            {
+                uint16_t v = find(address + r)->_value;
+                _tx.push_back(v >> 8);
+                _tx.push_back(v);
+            }
+        }
+        crc = crc16(_tx.data(), _tx.size());
+        _tx.push_back(crc);
+        _tx.push_back(crc >> 8);
+        return _tx;
+    }
+
+private:
+    struct Register
+    {
+        uint16_t _offset;
+        uint16_t _value;
+    };
+    const Register *find(uint16_t offset) const
+    {
+        for (auto i = _registers.begin(); i < _registers.end(); i++)
+        {
+            if (i->_offset == offset)
+                return &*i;
+        }
+        return nullptr;
+    }
+    uint8_t _slaveId;
+    std::vector<Register> _registers;
+    std::vector<uint8_t> _tx;
+};
+
+int main()
+{
+    constexpr uint8_t slave_id = 2;
+    constexpr uint32_t repeat = 200000;
+
+    BenchLink cachedLink, imageLink;
+    RtuServer cached(cachedLink), image(imageLink);
+    WithoutCache withoutCache(image);
+    Slave<WattNode> cachedSlave(cached, slave_id);
+    Slave<WattNode> imageSlave(withoutCache, slave_id);
+    RegisterList list(slave_id);
+
+    const struct
+    {
+        uint16_t _offset;
+        uint16_t _count;
+    } reads[] = {{1000, 34}, {1600, 23}};
+    for (auto r : reads)
+    {
+        uint8_t f[8] = {slave_id, Modbus::FC_READ_REGS, uint8_t(r._offset >> 8), uint8_t(r._offset), 0, uint8_t(r._count)};
+        uint16_t crc = crc16(f, 6);
+        f[6] = crc;
+        f[7] = crc >> 8;
+
+        // All three have to answer with the same frame
+        cachedLink.request(f, sizeof(f));
+        cached.serve(0);
+        imageLink.request(f, sizeof(f));
+        image.serve(0);
+        const std::vector<uint8_t> &before = list.answer(f, sizeof(f));
+        bool same = before.size() == 5u + 2 * r._count && imageLink._tx == before && cachedLink._tx == before;
+
+        double listNs = bench::nanos(repeat, [&]()
+                                     { bench::keep(list.answer(f, sizeof(f)).back()); });
+        double imageNs = bench::nanos(repeat, [&]()
+                                      {
+            imageLink.request(f, sizeof(f));
+            image.serve(0);
+            bench::keep(imageLink._tx.back()); });
+        double cachedNs = bench::nanos(repeat, [&]()
+                                       {
+            cachedLink.request(f, sizeof(f));
+            cached.serve(0);
+            bench::keep(cachedLink._tx.back()); });
+
+        Serial.printf("%u x %u, responses %s\r\n", r._offset, r._count, same ? "identical" : "DIFFER");
+        Serial.printf("  register list:   %7.0f ns\r\n", listNs);
+        Serial.printf("  register image:  %7.0f ns\r\n", imageNs);
+        Serial.printf("  response cache:  %7.0f ns\r\n", cachedNs);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file      timeouts.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host simulation of the request timeouts (RttEstimator) and the connection resets (Connection) against an
+ *            EM24 on a busy LAN that is dead for a while, and of the blocks of the requests a reset drops
+ */
+#include <Arduino.h>
+#include "simulation.h"
+#include "master.h"
+#include "em24.h"
+
+using namespace modbus;
+
+static bool within(unsigned long t, unsigned long from, unsigned long until)
+{
+    return (long)(t - from) >= 0 && (long)(t - until) < 0;
+}
+
+// The meter task, woken up at the next event of the Master or the next response of the meter
+static void step(Master<EM24> &master, bench::SimulatedMeter &meter)
+{
+    master.readPendingFromMeter();
+    meter.task();
+    unsigned long wait = std::min(master.nextEvent(millis(), 100) * 1000, meter.nextResponse(100000));
+    advanceMicros(std::max(wait, 200ul));
+}
+
+// 600 s of the EM24 schedule with a fraction of slow responses and the meter dead from 40 to 50 s
+static void outage(double slow)
+{
+    constexpr unsigned long duration = 600000000;
+    simulatedMicros = 0;
+    bench::MeterModel model;
+    model._service = 28000;
+    model._jitter = 20000;
+    model._perRegister = 250;
+    model._slow = slow;
+    model._deadFrom = 40000000;
+    model._deadUntil = 50000000;
+    bench::SimulatedMeter meter(model);
+    Master<EM24> master(meter, IPAddress(127, 0, 0, 1), meter.port());
+
+    unsigned long recovered = 0;
+    uint32_t completed = 0;
+    while (micros() < duration)
+    {
+        step(master, meter);
+        uint32_t c = master._scheduler.timing(EM24::dynamic)._completed;
+        if (c != completed && recovered == 0 && within(micros(), model._deadUntil, duration))
+            recovered = micros();
+        completed = c;
+    }
+
+    // Resets from the start of the outage until 3 s after it are expected
+    uint32_t healthy = 0;
+    unsigned long detected = 0;
+    for (unsigned long t : meter._resets)
+    {
+        if (!within(t, model._deadFrom, model._deadUntil + 3000000))
+            healthy++;
+        else if (detected == 0)
+            detected = t;
+    }
+    Serial.printf("%3.0f%% slow responses: resets while healthy %u, dynamic updates %4u, dead meter detected after %4lu ms, read again %4lu ms after it came back\r\n",
+                  slow * 100, healthy, completed, detected > 0 ? (detected - model._deadFrom) / 1000 : 0,
+                  recovered > 0 ? (recovered - model._deadUntil) / 1000 : 0);
+}
+
+// Every block in flight in its own request, then the meter dies and the first timeout resets the connection. The
+// blocks of the other requests have to be read again once the meter is back, nothing else asks for them.
+static void reset()
+{
+    simulatedMicros = 0;
+    bench::MeterModel model;
+    model._deadFrom = 10000000;
+    model._deadUntil = 11000000;
+    bench::SimulatedMeter meter(model);
+    Master<EM24> master(meter, IPAddress(127, 0, 0, 1), meter.port(), ReadPlanner::perBlock(), AdaptiveWindow(EM24::last_block));
+    master.connection().max_timeouts = 1;
+    for (uint16_t b = 0; b < EM24::last_block; b++)
+        master._scheduler.setPeriod(b, 0, millis());
+
+    uint32_t completed[EM24::last_block] = {};
+    uint32_t atReset[EM24::last_block] = {};
+    uint32_t lost = 0;
+    for (uint16_t b = 0; b < EM24::last_block; b++)
+        master.requestBlock(EM24::e_blocks(b));
+    while (micros() < 30000000)
+    {
+        for (uint16_t b = 0; b < EM24::last_block; b++)
+        {
+            uint32_t c = master._scheduler.timing(b)._completed;
+            if (c != completed[b] && micros() < model._deadFrom)
+                master.requestBlock(EM24::e_blocks(b));
+            completed[b] = c;
+        }
+        size_t resets = meter._resets.size();
+        uint32_t inFlight = master.inFlightBlocks();
+        step(master, meter);
+        if (resets == 0 && meter._resets.size() > 0)
+        {
+            lost = inFlight;
+            std::copy(completed, completed + EM24::last_block, atReset);
+        }
+    }
+
+    uint32_t again = 0;
+    for (uint16_t b = 0; b < EM24::last_block; b++)
+    {
+        if ((lost & (1 << b)) != 0 && completed[b] > atReset[b])
+            again |= 1 << b;
+    }
+    Serial.printf("reset with blocks 0x%x in flight: read again 0x%x\r\n", lost, again);
+}
+
+int main()
+{
+    for (double slow : {0.0, 0.1, 0.2})
+        outage(slow);
+    reset();
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file      window.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host simulation of the throughput of the meter reads for the sizes of the in-flight window
+ *            (AdaptiveWindow), against a simulated EM24 that handles one request at a time
+ */
+#include <Arduino.h>
+#include <vector>
+#include "simulation.h"
+#include "master.h"
+#include "em24.h"
+
+using namespace modbus;
+
+// Ask for every block again as soon as it arrived, for 60 s of simulated time, with a fixed delay per loop like
+// the meter task had. Prints the blocks read per second and the time from asking for a block to its arrival.
+static void run(const char *planning, const ReadPlanner &planner, uint8_t window, unsigned long loop, const bench::MeterModel &model)
+{
+    constexpr unsigned long warm_up = 5000000;
+    constexpr unsigned long duration = 60000000;
+    constexpr unsigned long give_up = 1500000;
+    simulatedMicros = 0;
+    bench::SimulatedMeter meter(model);
+    Master<EM24> m(meter, IPAddress(127, 0, 0, 1), meter.port(), planner, AdaptiveWindow(window));
+    for (uint16_t b = 0; b < EM24::last_block; b++)
+        m._scheduler.setPeriod(b, 0, millis());
+
+    unsigned long asked[EM24::last_block] = {};
+    uint32_t completed[EM24::last_block] = {};
+    std::vector<unsigned long> latencies;
+    uint32_t inFlight = 0;
+    uint32_t loops = 0;
+    while (micros() < duration)
+    {
+        unsigned long now = micros();
+        for (uint16_t b = 0; b < EM24::last_block; b++)
+        {
+            const BlockTiming &t = m._scheduler.timing(b);
+            if (t._completed != completed[b])
+            {
+                completed[b] = t._completed;
+                if (now > warm_up)
+                    latencies.push_back(now - asked[b]);
+                asked[b] = 0;
+            }
+            if (asked[b] == 0 || now - asked[b] > give_up)
+            {
+                asked[b] = now;
+                m.requestBlock(EM24::e_blocks(b));
+            }
+        }
+        m.readPendingFromMeter();
+        meter.task();
+        inFlight += m.inFlight();
+        loops++;
+        // The loop itself
+        advanceMicros(200);
+        delay(loop);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double mean = 0;
+    for (auto l : latencies)
+        mean += l;
+    mean = latencies.empty() ? 0 : mean / latencies.size() / 1000;
+    Serial.printf("%-9s window %u, loop %2lu ms, meter queue %3u: %6.1f blocks/s, latency mean %6.1f ms p95 %6.1f ms, timeouts %3u, window at the end %u, in flight %.2f\r\n",
+                  planning, window, loop, model._queue, latencies.size() / ((duration - warm_up) / 1e6), mean,
+                  latencies.empty() ? 0 : latencies[latencies.size() * 95 / 100] / 1000.0, meter._timeouts, m._window.size(),
+                  double(inFlight) / loops);
+}
+
+int main()
+{
+    bench::MeterModel model;
+    Serial.printf("Simulated EM24: %lu us each way, %lu us + %lu us per register per request, library timeout %u ms\r\n",
+                  model._oneWay, model._service, model._perRegister, MODBUSIP_TIMEOUT);
+    for (unsigned long loop : {20ul, 1ul})
+    {
+        for (uint8_t window : {1, 2, 4})
+            run("merged", ReadPlanner(), window, loop, model);
+    }
+    for (unsigned long loop : {20ul, 1ul})
+    {
+        for (uint8_t window : {1, 2, 4})
+            run("per block", ReadPlanner::perBlock(), window, loop, model);
+    }
+    // A meter that loses the requests beyond 2 waiting, the window has to stay below that
+    model._queue = 2;
+    for (unsigned long loop : {20ul, 1ul})
+        run("per block", ReadPlanner::perBlock(), 4, loop, model);
+    return 0;
+}
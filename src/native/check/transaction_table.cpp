@@ -0,0 +1,98 @@
+/**
+ * @file      transaction_table.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Host check of TransactionTable against std::map, random inserts, finds and erases. Exits with 1 on the
+ *            first difference.
+ */
+#include <Arduino.h>
+#include <map>
+#include "transaction_table.h"
+
+using namespace modbus;
+
+// Ids from a small range, so entries collide and probe sequences wrap around the end of the table, and the table
+// fills up. Ids as the library hands them out are checked too, wrapping from 65535 to 1.
+template <uint8_t capacity>
+static bool check(uint32_t operations, uint16_t range, bool sequential, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    TransactionTable<capacity> table;
+    std::map<uint16_t, uint8_t> expected;
+    uint16_t next = 65535 - 100;
+    for (uint32_t n = 0; n < operations; n++)
+    {
+        uint16_t id = random() % range;
+        uint8_t slot = random() % capacity;
+        switch (random() % 3)
+        {
+        case 0:
+        {
+            if (sequential)
+            {
+                id = next++;
+                if (next == 0)
+                    next = 1;
+            }
+            bool room = expected.size() < capacity || expected.count(id) > 0;
+            bool inserted = table.insert(id, slot);
+            if (inserted != (id != 0 && room))
+            {
+                Serial.printf("capacity %u: insert %u returned %d, %u entries\r\n", capacity, id, inserted, unsigned(expected.size()));
+                return false;
+            }
+            if (inserted)
+                expected[id] = slot;
+            break;
+        }
+        case 1:
+        {
+            // Mostly ids that are in the table
+            if (!expected.empty() && random() % 4 != 0)
+                id = std::next(expected.begin(), random() % expected.size())->first;
+            table.erase(id);
+            expected.erase(id);
+            break;
+        }
+        default:
+            if (random() % 1000 == 0)
+            {
+                table.clear();
+                expected.clear();
+            }
+            break;
+        }
+        // Every id of the range, and every id in the table, has to be found back with its slot or not at all
+        for (uint16_t i = 0; i < range; i++)
+        {
+            auto e = expected.find(i);
+            int16_t found = table.find(i);
+            if (found != (e == expected.end() ? -1 : e->second))
+            {
+                Serial.printf("capacity %u: after %u operations id %u found in slot %d, expected %d\r\n", capacity, n, i, found,
+                              e == expected.end() ? -1 : e->second);
+                return false;
+            }
+        }
+        for (auto e = expected.begin(); e != expected.end(); e++)
+        {
+            if (table.find(e->first) != e->second)
+            {
+                Serial.printf("capacity %u: after %u operations id %u not found\r\n", capacity, n, e->first);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    constexpr uint32_t operations = 200000;
+    bool ok = check<8>(operations, 40, false, 1) && check<8>(operations, 12, false, 2) && check<8>(operations, 1, true, 3) &&
+              check<4>(operations, 9, false, 4) && check<16>(operations, 70, false, 5) && check<2>(operations, 5, false, 6);
+    Serial.printf("TransactionTable %s std::map\r\n", ok ? "agrees with" : "DIFFERS from");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file      main.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      The gateway on a POSIX host: polls the meters over TCP and serves the WattNode on a pseudo terminal
+ */
+#include <Arduino.h>
+#include <csignal>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include "posix_transport.h"
+#include "definitions.h"
+#include "slave.h"
+#include "master.h"
+#include "em24.h"
+#include "wattnode.h"
+#include "meter_aggregate.h"
+#include "convert_em24_to_wattnode.h"
+#include "alloc_counter.h"
+
+// Usage: modbus_gateway [-l link] [-b baud] [-w slave meter[:port]] [meter[:port][,sign] ...]
+//   -l link  symbolic link to the pseudo terminal the inverter (or a simulation of it) opens, default ./wattnode
+//   -b baud  speed of the bus the pseudo terminal stands in for, sets the silent time that ends a frame, default 9600
+//   -w       an additional WattNode on the bus, answering slave from the values of its own meter. Can be repeated.
+//   meter    address of an EM24, default REMOTE, REMOTE2 and REMOTE3 from secrets.ini. A sign of -1 subtracts
+//            its power and energy from the first meter. These are the meters of the WattNode SLAVE_ID.
+// Stops on SIGINT or SIGTERM and prints the polling schedule, the reads and the queries of the inverter.
+
+static volatile sig_atomic_t running = 1;
+static void stop(int)
+{
+    running = 0;
+}
+
+struct MeterAddress
+{
+    IPAddress _ip;
+    uint16_t _port;
+    int8_t _sign;
+};
+
+static bool parse(const char *arg, MeterAddress &m)
+{
+    const char *colon = strchr(arg, ':');
+    const char *comma = strchr(arg, ',');
+    size_t length = strcspn(arg, ":,");
+    char host[64];
+    if (length >= sizeof(host))
+        return false;
+    memcpy(host, arg, length);
+    host[length] = 0;
+    m._port = colon ? atoi(colon + 1) : 502;
+    m._sign = comma && atoi(comma + 1) < 0 ? -1 : 1;
+    return m._ip.fromString(host);
+}
+
+// One round of the meter task of modbus_gateway.cpp, for the WattNode converted by converter
+static void poll(modbus::ConvertEM24ToWattNode &converter, modbus::MeterAggregate<modbus::EM24> &meter, modbus::PosixTcpClient *tcp)
+{
+    converter.ScheduleFromDemand(millis());
+    for (uint8_t i = 0; i < meter.size(); i++)
+        meter[i].readPendingFromMeter();
+    for (uint8_t i = 0; i < meter.size(); i++)
+        tcp[i].task();
+    if (meter.takeDataRead())
+        converter.CopyDataFromMasterToSlave();
+    meter.wait(100);
+}
+
+// An additional WattNode, with a single meter
+struct Feed
+{
+    Feed(modbus::ServerTransport &rtu, uint8_t slaveId, const MeterAddress &address)
+        : _slaveId(slaveId), _master(_tcp, address._ip, address._port), _meter(&_master, &_sign, 1),
+          _wattnode(rtu, slaveId), _converter(_meter, _wattnode)
+    {
+    }
+    uint8_t _slaveId;
+    int8_t _sign = 1;
+    modbus::PosixTcpClient _tcp;
+    modbus::Master<modbus::EM24> _master;
+    modbus::MeterAggregate<modbus::EM24> _meter;
+    modbus::Slave<modbus::WattNode> _wattnode;
+    modbus::ConvertEM24ToWattNode _converter;
+};
+
+// Meters added without a sign in secrets.ini are summed, like on the ESP32
+#ifndef REMOTE2_SIGN
+#define REMOTE2_SIGN 1
+#endif
+#ifndef REMOTE3_SIGN
+#define REMOTE3_SIGN 1
+#endif
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+int main(int argc, char **argv)
+{
+    const char *link = "wattnode";
+    modbus::LineSettings line;
+    constexpr uint8_t max_meters = 3; // see MeterAggregate
+    MeterAddress addresses[max_meters];
+    uint8_t number_meters = 0;
+    constexpr uint8_t max_feeds = modbus::RtuServer::max_slaves - 1;
+    uint8_t feedSlaves[max_feeds];
+    MeterAddress feedAddresses[max_feeds];
+    uint8_t number_feeds = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            link = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            line._baud = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 2 < argc && number_feeds < max_feeds && parse(argv[i + 2], feedAddresses[number_feeds]))
+        {
+            feedSlaves[number_feeds++] = atoi(argv[i + 1]);
+            i += 2;
+        }
+        else if (number_meters < max_meters && parse(argv[i], addresses[number_meters]))
+            number_meters++;
+        else
+        {
+            Serial.printf("Usage: %s [-l link] [-b baud] [-w slave meter[:port]] [meter[:port][,sign] ...]\r\n", argv[0]);
+            return 1;
+        }
+    }
+    if (number_meters == 0)
+    {
+        const char *defaults[] = {
+            REMOTE,
+#ifdef REMOTE2
+            REMOTE2 "," TO_STRING(REMOTE2_SIGN),
+#endif
+#ifdef REMOTE3
+            REMOTE3 "," TO_STRING(REMOTE3_SIGN),
+#endif
+        };
+        for (const char *d : defaults)
+            parse(d, addresses[number_meters++]);
+    }
+
+    // Master can not be copied, so the meters are constructed in place, in one array like on the ESP32
+    modbus::PosixTcpClient tcp[max_meters];
+    auto *meters = static_cast<modbus::Master<modbus::EM24> *>(::operator new(sizeof(modbus::Master<modbus::EM24>) * number_meters));
+    int8_t signs[max_meters];
+    for (uint8_t i = 0; i < number_meters; i++)
+    {
+        new (&meters[i]) modbus::Master<modbus::EM24>(tcp[i], addresses[i]._ip, addresses[i]._port);
+        signs[i] = addresses[i]._sign;
+    }
+    modbus::MeterAggregate<modbus::EM24> meter(meters, signs, number_meters);
+
+    modbus::PtyLink pty;
+    if (!line.valid() || !pty.begin(link, line._baud))
+    {
+        Serial.printf("ERROR: pseudo terminal %s not created\r\n", link);
+        return 1;
+    }
+    modbus::RtuServer rtu(pty);
+    modbus::Slave<modbus::WattNode> wattnode(rtu, SLAVE_ID);
+    modbus::ConvertEM24ToWattNode converter(meter, wattnode);
+    char settings[24];
+    Serial.printf("WattNode slave %u on %s (%s), %s\r\n", SLAVE_ID, link, pty.name(), line.toString(settings, sizeof(settings)));
+    std::unique_ptr<Feed> feeds[max_feeds];
+    for (uint8_t f = 0; f < number_feeds; f++)
+    {
+        feeds[f].reset(new Feed(rtu, feedSlaves[f], feedAddresses[f]));
+        feeds[f]->_wattnode.setValue(modbus::WattNode::modbus_address, modbus::Value::_int16_t(feedSlaves[f]));
+        feeds[f]->_wattnode.setValue(modbus::WattNode::serial_number, modbus::Value::_uint32_t(SERIAL_NUMBER + f + 1));
+        Serial.printf("WattNode slave %u from %s:%u\r\n", feedSlaves[f], feedAddresses[f]._ip.toString().c_str(), feedAddresses[f]._port);
+    }
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    // Same tasks as in modbus_gateway.cpp: the inverter is answered by its own thread, this one polls the meters of
+    // the first WattNode and every additional WattNode has a thread of its own.
+    // All sleep until there is something to do, the timeouts only bound the time to notice a stop.
+    std::thread rtuThread([&]()
+                          {
+        while (running)
+            rtu.serve(100); });
+    std::thread feedThreads[max_feeds];
+    for (uint8_t f = 0; f < number_feeds; f++)
+        feedThreads[f] = std::thread([&feed = *feeds[f]]()
+                                     {
+            modbus::countAllocations();
+            while (running)
+                poll(feed._converter, feed._meter, &feed._tcp); });
+    modbus::countAllocations();
+    while (running)
+        poll(converter, meter, tcp);
+    rtuThread.join();
+    for (uint8_t f = 0; f < number_feeds; f++)
+        feedThreads[f].join();
+
+    char buf[100];
+    sprintf(buf, "WattNode %u reads\r\n", SLAVE_ID);
+    String r = buf;
+    r += wattnode._demand.toString(millis());
+    for (uint8_t f = 0; f < number_feeds; f++)
+    {
+        sprintf(buf, "WattNode %u reads\r\n", feeds[f]->_slaveId);
+        r += buf;
+        r += feeds[f]->_wattnode._demand.toString(millis());
+    }
+    sprintf(buf, "Response cache: hits=%u, misses=%u\r\n", rtu.cache().hits(), rtu.cache().misses());
+    r += buf;
+    r += "Queries\r\n";
+    r += rtu.trace().report();
+    for (uint8_t i = 0; i < number_meters; i++)
+        r += meters[i].scheduleAsString();
+    for (uint8_t f = 0; f < number_feeds; f++)
+        r += feeds[f]->_master.scheduleAsString();
+    Serial.print(r);
+    for (uint8_t i = 0; i < number_meters; i++)
+        meters[i].~Master();
+    ::operator delete(meters);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/**
+ * @file      posix_transport.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Transports on a POSIX host: Modbus TCP over a socket, the RTU link over a pseudo terminal
+ */
+#pragma once
+
+#include "transport.h"
+#include "rtu_server.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <lwip/sockets.h>
+
+namespace modbus
+{
+    // PosixTcpClient. ClientTransport on a non blocking socket. Like ModbusTCP it connects to one meter at a time,
+    // addresses the requests to unit 255 and times them out after MODBUSIP_TIMEOUT.
+    class PosixTcpClient : public ClientTransport
+    {
+    public:
+        ~PosixTcpClient()
+        {
+            close();
+        }
+
+        bool attach(const IPAddress &remote, int fd) override
+        {
+            close();
+            _fd = fd;
+            int one = 1;
+            setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+            _remote = remote;
+            return true;
+        }
+        bool disconnect(const IPAddress &remote) override
+        {
+            if (!(remote == _remote))
+                return false;
+            close();
+            return true;
+        }
+        bool isConnected(const IPAddress &remote) override
+        {
+            return _fd >= 0 && remote == _remote;
+        }
+        uint16_t readIreg(const IPAddress &remote, uint16_t offset, uint16_t *values, uint16_t number_reg, cbTransaction cb) override
+        {
+            Pending *p = free();
+            if (!isConnected(remote) || !p)
+                return 0;
+            if (++_id == 0)
+                _id = 1;
+            uint8_t frame[] = {uint8_t(_id >> 8), uint8_t(_id), 0, 0, 0, 6, unit,
+                               Modbus::FC_READ_INPUT_REGS, uint8_t(offset >> 8), uint8_t(offset), uint8_t(number_reg >> 8), uint8_t(number_reg)};
+            if (send(_fd, frame, sizeof(frame), MSG_NOSIGNAL) != sizeof(frame))
+            {
+                close();
+                return 0;
+            }
+            *p = Pending{_id, values, number_reg, millis(), cb};
+            return _id;
+        }
+        void dropTransactions() override
+        {
+            for (auto i = std::begin(_pending); i < std::end(_pending); i++)
+            {
+                if (i->_id != 0)
+                    complete(*i, Modbus::EX_CANCEL);
+            }
+        }
+        void task() override
+        {
+            receive();
+            unsigned long now = millis();
+            for (auto i = std::begin(_pending); i < std::end(_pending); i++)
+            {
+                if (i->_id != 0 && now - i->_sent > MODBUSIP_TIMEOUT)
+                    complete(*i, Modbus::EX_TIMEOUT);
+            }
+        }
+        int socket(const IPAddress &remote) override
+        {
+            return isConnected(remote) ? _fd : -1;
+        }
+
+    private:
+        static constexpr uint8_t unit = 0xFF;
+        static constexpr uint8_t max_pending = 16;
+        static constexpr size_t max_frame = 7 + 2 + 250;
+        struct Pending
+        {
+            uint16_t _id = 0;
+            uint16_t *_values = nullptr;
+            uint16_t _number_reg = 0;
+            unsigned long _sent = 0;
+            cbTransaction _cb;
+        };
+        Pending *free()
+        {
+            for (auto i = std::begin(_pending); i < std::end(_pending); i++)
+            {
+                if (i->_id == 0)
+                    return i;
+            }
+            return nullptr;
+        }
+        // The callback may send or drop requests, so the transaction is released before it is called
+        void complete(Pending &p, Modbus::ResultCode result)
+        {
+            uint16_t id = p._id;
+            cbTransaction cb = std::move(p._cb);
+            p = Pending();
+            if (cb)
+                cb(result, id, nullptr);
+        }
+        void receive()
+        {
+            while (_fd >= 0)
+            {
+                ssize_t n = recv(_fd, _rx + _length, sizeof(_rx) - _length, 0);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    close();
+                    return;
+                }
+                if (n < 0)
+                    return;
+                _length += n;
+                // MBAP header: transaction id, protocol id, length of unit id and PDU
+                while (_length >= 7)
+                {
+                    size_t frame = 6 + ((_rx[4] << 8) | _rx[5]);
+                    if (frame < 8 || frame > sizeof(_rx))
+                    {
+                        close();
+                        return;
+                    }
+                    if (_length < frame)
+                        break;
+                    process(_rx, frame);
+                    // The callback may have closed the connection
+                    if (_fd < 0)
+                        return;
+                    memmove(_rx, _rx + frame, _length - frame);
+                    _length -= frame;
+                }
+            }
+        }
+        void process(const uint8_t *frame, size_t length)
+        {
+            uint16_t id = (frame[0] << 8) | frame[1];
+            for (auto i = std::begin(_pending); i < std::end(_pending); i++)
+            {
+                if (i->_id != id)
+                    continue;
+                uint8_t fc = frame[7];
+                if (length < 9)
+                    complete(*i, Modbus::EX_UNEXPECTED_RESPONSE);
+                else if (fc == (Modbus::FC_READ_INPUT_REGS | 0x80))
+                    complete(*i, Modbus::ResultCode(frame[8]));
+                else if (fc != Modbus::FC_READ_INPUT_REGS || frame[8] != 2 * i->_number_reg || length < 9u + frame[8])
+                    complete(*i, Modbus::EX_UNEXPECTED_RESPONSE);
+                else
+                {
+                    for (uint16_t r = 0; r < i->_number_reg; r++)
+                        i->_values[r] = (frame[9 + 2 * r] << 8) | frame[10 + 2 * r];
+                    complete(*i, Modbus::EX_SUCCESS);
+                }
+                return;
+            }
+        }
+        void close()
+        {
+            if (_fd >= 0)
+                ::close(_fd);
+            _fd = -1;
+            _length = 0;
+        }
+
+        int _fd = -1;
+        IPAddress _remote;
+        uint16_t _id = 0;
+        Pending _pending[max_pending];
+        uint8_t _rx[max_frame];
+        size_t _length = 0;
+    };
+
+    // PtyLink. SerialLink on a pseudo terminal, the client opens the slave side of it, see name().
+    // A pseudo terminal has no line and no RX timeout, the end of a frame is found like the UART does: when no byte
+    // arrived for the interframe time of the baud rate the link emulates.
+    class PtyLink : public SerialLink
+    {
+    public:
+        ~PtyLink()
+        {
+            if (_fd >= 0)
+                close(_fd);
+            if (_hold >= 0)
+                close(_hold);
+            if (!_link.empty())
+                unlink(_link.c_str());
+        }
+
+        // Open the pseudo terminal, and if given make link point to its slave side
+        bool begin(const char *link = nullptr, uint32_t baud = 9600)
+        {
+            _interframe = interframeMicros(baud);
+            _fd = posix_openpt(O_RDWR | O_NOCTTY);
+            if (_fd < 0 || grantpt(_fd) != 0 || unlockpt(_fd) != 0)
+                return false;
+            struct termios t;
+            tcgetattr(_fd, &t);
+            cfmakeraw(&t);
+            tcsetattr(_fd, TCSANOW, &t);
+            fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+            // Keep the slave side open, otherwise the master side polls as hung up while no client has it open
+            _hold = open(ptsname(_fd), O_RDWR | O_NOCTTY);
+            if (link)
+            {
+                unlink(link);
+                if (symlink(ptsname(_fd), link) != 0)
+                    return false;
+                _link = link;
+            }
+            return true;
+        }
+
+        bool wait(uint32_t timeout) override
+        {
+            struct pollfd p = {_fd, POLLIN, 0};
+            if (_fd < 0 || ::poll(&p, 1, timeout) <= 0)
+                return false;
+            int before = -1;
+            int available = 0;
+            while (ioctl(_fd, FIONREAD, &available) == 0 && available != before)
+            {
+                before = available;
+                usleep(_interframe);
+            }
+            return true;
+        }
+        size_t read(uint8_t *data, size_t length) override
+        {
+            ssize_t n = _fd >= 0 ? ::read(_fd, data, length) : -1;
+            return n > 0 ? n : 0;
+        }
+        bool write(const uint8_t *data, size_t length) override
+        {
+            return _fd >= 0 && ::write(_fd, data, length) == ssize_t(length);
+        }
+        const char *name() const override
+        {
+            return _fd >= 0 ? ptsname(_fd) : "";
+        }
+        // Only the speed matters, for the interframe time
+        bool configure(const LineSettings &settings) override
+        {
+            _interframe = interframeMicros(settings._baud);
+            if (_fd >= 0)
+                tcflush(_fd, TCIFLUSH);
+            return true;
+        }
+        uint32_t errors() const override
+        {
+            return 0;
+        }
+
+    private:
+        int _fd = -1;
+        int _hold = -1;
+        uint32_t _interframe = 0;
+        std::string _link;
+    };
+}
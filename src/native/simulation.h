@@ -0,0 +1,258 @@
+/**
+ * @file      simulation.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      A simulated EM24 behind a simulated network and a simulated inverter, for the host benchmarks that run the
+ *            meter polling for minutes in simulated time ([env:bench_*] with -DSIMULATED_CLOCK in platformio.ini)
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include <deque>
+#include <random>
+#include <lwip/sockets.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "transport.h"
+
+#ifndef SIMULATED_CLOCK
+#error "The simulations advance the clock themselves, build them with -DSIMULATED_CLOCK"
+#endif
+
+namespace bench
+{
+    // MeterModel. How the meter and the network to it answer. Times in us.
+    struct MeterModel
+    {
+        // Network delay each way
+        unsigned long _oneWay = 1000;
+        // The meter handles one request at a time, taking this long per request and per register
+        unsigned long _service = 6000;
+        unsigned long _perRegister = 50;
+        // Plus up to this long, drawn per request
+        unsigned long _jitter = 0;
+        // Requests the meter keeps waiting while it handles one, more are lost
+        uint8_t _queue = UINT8_MAX;
+        // Fraction of the responses that take between _slowMin and _slowMax instead, e.g. on a busy LAN
+        double _slow = 0;
+        unsigned long _slowMin = 300000;
+        unsigned long _slowMax = 1400000;
+        // Reads of more registers are refused with EX_ILLEGAL_ADDRESS
+        uint16_t _maxRead = 125;
+        // Nothing is answered from _deadFrom until _deadUntil, not even the requests that arrived before
+        unsigned long _deadFrom = 0;
+        unsigned long _deadUntil = 0;
+    };
+
+    // SimulatedMeter. ClientTransport that answers from a MeterModel in simulated time. Like modbus-esp8266 it reports
+    // the result of a request from task(), and times a request out after MODBUSIP_TIMEOUT.
+    // The Master connects to a loopback port that accepts and drops the connections, see port().
+    class SimulatedMeter : public modbus::ClientTransport
+    {
+    public:
+        SimulatedMeter(const MeterModel &model) : _model(model)
+        {
+            _listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            struct sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(addr);
+            if (bind(_listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(_listener, 16) < 0 ||
+                getsockname(_listener, (struct sockaddr *)&addr, &length) < 0)
+                Serial.printf("ERROR: no loopback port for the simulated meter\r\n");
+            fcntl(_listener, F_SETFL, fcntl(_listener, F_GETFL, 0) | O_NONBLOCK);
+            _port = ntohs(addr.sin_port);
+        }
+        ~SimulatedMeter()
+        {
+            close(_listener);
+        }
+        SimulatedMeter(const SimulatedMeter &) = delete;
+        SimulatedMeter &operator=(const SimulatedMeter &) = delete;
+
+        // Port to give the Master, at 127.0.0.1
+        uint16_t port() const
+        {
+            return _port;
+        }
+
+        bool attach(const IPAddress &, int fd) override
+        {
+            close(fd);
+            _connected = true;
+            return true;
+        }
+        bool disconnect(const IPAddress &) override
+        {
+            _connected = false;
+            _resets.push_back(micros());
+            return true;
+        }
+        bool isConnected(const IPAddress &) override
+        {
+            return _connected;
+        }
+        uint16_t readIreg(const IPAddress &, uint16_t offset, uint16_t *values, uint16_t number_reg, cbTransaction cb) override
+        {
+            if (!_connected)
+                return 0;
+            unsigned long now = micros();
+            uint16_t id = _nextId++;
+            if (_nextId == 0)
+                _nextId = 1;
+            _requests++;
+            _registers += number_reg;
+
+            Response r = {now + library_timeout, id, Modbus::EX_TIMEOUT, cb};
+            unsigned long arrival = now + _model._oneWay;
+            while (!_busy.empty() && _busy.front() <= arrival)
+                _busy.pop_front();
+            if (!dead(arrival) && _busy.size() <= _model._queue)
+            {
+                std::uniform_real_distribution<double> uniform(0, 1);
+                unsigned long start = std::max(arrival, _free);
+                _free = start + _model._service + _model._perRegister * number_reg + uniform(_random) * _model._jitter;
+                _busy.push_back(_free);
+                unsigned long answered = _free + _model._oneWay;
+                if (_model._slow > 0 && uniform(_random) < _model._slow)
+                    answered = now + _model._slowMin + uniform(_random) * (_model._slowMax - _model._slowMin);
+                if (answered - now < library_timeout && !dead(answered))
+                {
+                    r._due = answered;
+                    r._result = number_reg > _model._maxRead ? Modbus::EX_ILLEGAL_ADDRESS : Modbus::EX_SUCCESS;
+                    for (uint16_t i = 0; i < number_reg; i++)
+                        values[i] = offset + i;
+                }
+            }
+            if (r._result == Modbus::EX_TIMEOUT)
+                _timeouts++;
+            _responses.push_back(r);
+            return id;
+        }
+        void dropTransactions() override
+        {
+            std::vector<Response> dropped;
+            dropped.swap(_responses);
+            for (auto i = dropped.begin(); i < dropped.end(); i++)
+                i->_cb(Modbus::EX_CANCEL, i->_id, nullptr);
+        }
+        void task() override
+        {
+            int fd;
+            while ((fd = accept(_listener, nullptr, nullptr)) >= 0)
+                close(fd);
+            unsigned long now = micros();
+            for (bool found = true; found;)
+            {
+                // In the order they are due, a callback may send new requests
+                auto first = _responses.end();
+                for (auto i = _responses.begin(); i < _responses.end(); i++)
+                {
+                    if ((long)(now - i->_due) >= 0 && (first == _responses.end() || (long)(i->_due - first->_due) < 0))
+                        first = i;
+                }
+                found = first != _responses.end();
+                if (found)
+                {
+                    Response r = *first;
+                    _responses.erase(first);
+                    r._cb(r._result, r._id, nullptr);
+                }
+            }
+        }
+        int socket(const IPAddress &) override
+        {
+            return -1;
+        }
+
+        // Time the next response or timeout is reported, at most limit us from now
+        unsigned long nextResponse(unsigned long limit) const
+        {
+            unsigned long now = micros();
+            for (auto i = _responses.begin(); i < _responses.end(); i++)
+                limit = std::min(limit, (unsigned long)std::max(long(i->_due - now), 0l));
+            return limit;
+        }
+
+        uint32_t _requests = 0;
+        uint32_t _registers = 0;
+        // Requests the meter never answered
+        uint32_t _timeouts = 0;
+        // Times the Master reset the connection
+        std::vector<unsigned long> _resets;
+
+    private:
+        static constexpr unsigned long library_timeout = MODBUSIP_TIMEOUT * 1000ul;
+        struct Response
+        {
+            unsigned long _due;
+            uint16_t _id;
+            Modbus::ResultCode _result;
+            cbTransaction _cb;
+        };
+
+        bool dead(unsigned long t) const
+        {
+            return (long)(t - _model._deadFrom) >= 0 && (long)(t - _model._deadUntil) < 0;
+        }
+
+        MeterModel _model;
+        int _listener = -1;
+        uint16_t _port = 0;
+        bool _connected = false;
+        uint16_t _nextId = 1;
+        // Time the meter is done with the requests it has
+        unsigned long _free = 0;
+        std::deque<unsigned long> _busy;
+        std::vector<Response> _responses;
+        std::mt19937 _random{1};
+    };
+
+    // SimulatedInverter. ServerTransport that hands the reads of a simulated inverter straight to the slaves, the
+    // request callback first like RtuServer
+    class SimulatedInverter : public modbus::ServerTransport
+    {
+    public:
+        bool slave(uint8_t slaveId, cbRequest request, cbReadHregs read, cbWriteHregs, cbHregsVersion) override
+        {
+            if (_number_slaves == max_slaves)
+                return false;
+            _slaves[_number_slaves++] = {slaveId, request, read};
+            return true;
+        }
+        void task() override
+        {
+        }
+
+        Modbus::ResultCode read(uint8_t slaveId, uint16_t offset, uint16_t count)
+        {
+            for (uint8_t i = 0; i < _number_slaves; i++)
+            {
+                const Handlers &h = _slaves[i];
+                if (h._slaveId != slaveId)
+                    continue;
+                Modbus::RequestData data(HREG(offset), count);
+                Modbus::ResultCode result = h._request ? h._request(Modbus::FC_READ_REGS, data) : Modbus::EX_SUCCESS;
+                uint16_t values[125];
+                if (result == Modbus::EX_SUCCESS)
+                    result = count <= 125 ? h._read(offset, count, values) : Modbus::EX_ILLEGAL_VALUE;
+                return result;
+            }
+            return Modbus::EX_DEVICE_FAILED_TO_RESPOND;
+        }
+
+    private:
+        static constexpr uint8_t max_slaves = 4;
+        struct Handlers
+        {
+            uint8_t _slaveId;
+            cbRequest _request;
+            cbReadHregs _read;
+        };
+        Handlers _slaves[max_slaves];
+        uint8_t _number_slaves = 0;
+    };
+}
@@ -0,0 +1,76 @@
+/**
+ * @file      read_planner.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Merge the blocks to be read from a meter into as few modbus requests as possible
+ */
+#pragma once
+
+#include "definitions.h"
+
+namespace modbus
+{
+    // ReadRequest. One modbus read, covering one or more blocks given as a bit mask of block indexes
+    struct ReadRequest
+    {
+        uint16_t _offset;
+        uint16_t _number_reg;
+        uint32_t _blocks;
+    };
+
+    // ReadPlanner. Given the blocks that are due, merge adjacent or nearby blocks into a single read.
+    // Two blocks are merged when the unused registers between them do not exceed max_gap and the merged
+    // read does not exceed max_registers. The blocks must be ordered by address, which
+    // DeviceDescription::isContiguous guarantees. Scanning in address order and extending the current
+    // request as long as possible gives the minimal number of requests.
+    // With max_registers 0 nothing is merged, every block is read with a request of its own.
+    class ReadPlanner
+    {
+    public:
+        ReadPlanner(uint16_t max_gap = 20, uint16_t max_registers = 125)
+            : _max_gap(max_gap), _max_registers(max_registers)
+        {
+        }
+        static ReadPlanner perBlock()
+        {
+            return ReadPlanner(0, 0);
+        }
+        bool merges() const
+        {
+            return _max_registers > 0;
+        }
+
+        // Plan the requests for the blocks in the due mask. Returns the number of requests written to requests.
+        uint8_t plan(Span<Block> blocks, uint32_t due, ReadRequest *requests, uint8_t max_requests) const
+        {
+            uint8_t n = 0;
+            for (uint16_t b = 0; b < blocks.size() && b < 32; b++)
+            {
+                if (!(due & (uint32_t(1) << b)) || blocks[b]._number_reg == 0)
+                    continue;
+                const Block &block = blocks[b];
+                if (n > 0)
+                {
+                    ReadRequest &last = requests[n - 1];
+                    uint16_t end = last._offset + last._number_reg;
+                    uint16_t merged = block._offset + block._number_reg - last._offset;
+                    if (block._offset - end <= _max_gap && merged <= _max_registers)
+                    {
+                        last._number_reg = merged;
+                        last._blocks |= uint32_t(1) << b;
+                        continue;
+                    }
+                }
+                if (n == max_requests)
+                    break;
+                requests[n++] = ReadRequest{block._offset, block._number_reg, uint32_t(1) << b};
+            }
+            return n;
+        }
+
+        uint16_t _max_gap;
+        uint16_t _max_registers;
+    };
+}
@@ -0,0 +1,151 @@
+/**
+ * @file      request_trace.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Record of the recent requests of the inverter, and the query patterns found in it
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+
+namespace modbus
+{
+    // One request as answered by the RTU server. The arrival is the time the link reported the end of the request, so
+    // after the silent time that ends it on the bus. The response time runs from there until the response was handed
+    // to the link, it includes reading the request but not the silent time. result is 0 when it succeeded.
+    struct RequestRecord
+    {
+        uint32_t _arrival = 0;
+        uint16_t _start = 0;
+        uint16_t _count = 0;
+        uint16_t _response = 0;
+        uint8_t _slaveId = 0;
+        uint8_t _fc = 0;
+        uint8_t _result = 0;
+    };
+
+    // RequestTrace. The last N requests, in a ring that the task answering the requests writes without waiting for
+    // anyone. Readers copy it with snapshot(). Each slot has a sequence that is odd while the slot is written and
+    // tells which lap of the ring the record belongs to, so a record that is overwritten while it is copied is
+    // left out instead of read half old, half new.
+    template <uint32_t N>
+    class RequestTrace
+    {
+    public:
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+        static constexpr uint32_t size = N;
+
+        // Writer side, one task only
+        void record(const RequestRecord &r)
+        {
+            uint32_t head = _head.load(std::memory_order_relaxed);
+            Slot &s = _slots[head & (N - 1)];
+            uint32_t sequence = s._sequence.load(std::memory_order_relaxed);
+            s._sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s._record = r;
+            s._sequence.store(sequence + 2, std::memory_order_release);
+            _head.store(head + 1, std::memory_order_release);
+        }
+
+        // Copy the most recent records, at most max, oldest first. Returns the number copied.
+        uint32_t snapshot(RequestRecord *records, uint32_t max) const
+        {
+            uint32_t head = _head.load(std::memory_order_acquire);
+            uint32_t n = std::min(std::min(head, N), max);
+            uint32_t copied = 0;
+            for (uint32_t i = head - n; i != head; i++)
+            {
+                const Slot &s = _slots[i & (N - 1)];
+                uint32_t before = s._sequence.load(std::memory_order_acquire);
+                RequestRecord r = s._record;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                // Written once per lap, so after record i the sequence is twice the number of laps up to it
+                if (before != 2 * (i / N + 1) || s._sequence.load(std::memory_order_relaxed) != before)
+                    continue;
+                records[copied++] = r;
+            }
+            return copied;
+        }
+
+        // Number of requests recorded since the start
+        uint32_t recorded() const
+        {
+            return _head.load(std::memory_order_relaxed);
+        }
+
+        // The distinct requests (slave, function code, start and count) in the trace, with how often they came and how fast
+        // they were answered, most frequent first. Response times are in us, rates per second.
+        String report() const
+        {
+            static RequestRecord records[N];
+            uint32_t n = snapshot(records, N);
+            String result;
+            char buf[200];
+            if (n == 0)
+                return "No requests recorded\r\n";
+            snprintf(buf, sizeof(buf), "Last %u of %u requests, over %.1f s, response times from the end of the silent time after a request\r\n", n, recorded(),
+                     (records[n - 1]._arrival - records[0]._arrival) / 1e6);
+            result += buf;
+
+            // Group the records by query, within a query by response time, for the percentiles
+            std::sort(records, records + n, [](const RequestRecord &a, const RequestRecord &b)
+                      { return key(a) != key(b) ? key(a) < key(b) : a._response < b._response; });
+            struct Pattern
+            {
+                uint32_t _first;
+                uint32_t _number;
+            };
+            static Pattern patterns[N];
+            uint32_t number_patterns = 0;
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (i == 0 || key(records[i]) != key(records[i - 1]))
+                    patterns[number_patterns++] = {i, 0};
+                patterns[number_patterns - 1]._number++;
+            }
+            std::sort(patterns, patterns + number_patterns, [](const Pattern &a, const Pattern &b)
+                      { return a._number > b._number; });
+
+            for (uint32_t p = 0; p < number_patterns; p++)
+            {
+                const RequestRecord *r = records + patterns[p]._first;
+                uint32_t number = patterns[p]._number;
+                uint32_t first = r[0]._arrival, last = r[0]._arrival, failed = 0;
+                for (uint32_t i = 0; i < number; i++)
+                {
+                    if ((int32_t)(r[i]._arrival - first) < 0)
+                        first = r[i]._arrival;
+                    if ((int32_t)(r[i]._arrival - last) > 0)
+                        last = r[i]._arrival;
+                    failed += r[i]._result != 0;
+                }
+                auto percentile = [&](uint32_t q)
+                { return r[std::min(number - 1, number * q / 100)]._response; };
+                snprintf(buf, sizeof(buf), "Slave %u FC %u %u x %u: requests=%u, rate=%.2f/s, response p50=%u us p90=%u us p99=%u us max=%u us, exceptions=%u\r\n",
+                         r[0]._slaveId, r[0]._fc, r[0]._start, r[0]._count, number, last != first ? (number - 1) * 1e6 / (last - first) : 0.0,
+                         percentile(50), percentile(90), percentile(99), r[number - 1]._response, failed);
+                result += buf;
+            }
+            return result;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint32_t> _sequence{0};
+            RequestRecord _record;
+        };
+        static uint64_t key(const RequestRecord &r)
+        {
+            return uint64_t(r._slaveId) << 40 | uint64_t(r._fc) << 32 | uint32_t(r._start) << 16 | r._count;
+        }
+
+        Slot _slots[N];
+        std::atomic<uint32_t> _head{0};
+    };
+}
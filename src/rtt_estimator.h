@@ -0,0 +1,91 @@
+/**
+ * @file      rtt_estimator.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Time to wait for the response of a request, derived from the measured response times
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+
+namespace modbus
+{
+    // RttEstimator. Smoothed response time and its smoothed variation, and the timeout derived from them, the way TCP
+    // computes its retransmission timeout (RFC 6298): timeout = srtt + max(granularity, 4 * rttvar).
+    // Every timeout doubles the timeout until a response is measured again. Until the first response the initial
+    // timeout is used.
+    class RttEstimator
+    {
+    public:
+        RttEstimator(uint16_t min_timeout = 200, uint16_t max_timeout = 1000, uint16_t granularity = 20)
+            : _min_timeout(min_timeout), _max_timeout(max_timeout), _granularity(granularity)
+        {
+        }
+
+        void onResponse(unsigned long rtt_ms)
+        {
+            if (_samples == 0)
+            {
+                _srtt = rtt_ms;
+                _rttvar = rtt_ms / 2;
+            }
+            else
+            {
+                unsigned long deviation = rtt_ms > _srtt ? rtt_ms - _srtt : _srtt - rtt_ms;
+                _rttvar = (3 * _rttvar + deviation) / 4;
+                _srtt = (7 * _srtt + rtt_ms) / 8;
+            }
+            if (_samples < UINT32_MAX)
+                _samples++;
+            _backoff = 0;
+        }
+        void onTimeout()
+        {
+            if (_backoff < max_backoff)
+                _backoff++;
+            _timeouts++;
+        }
+
+        unsigned long timeout() const
+        {
+            unsigned long t = _samples == 0 ? _max_timeout : _srtt + std::max<unsigned long>(_granularity, 4 * _rttvar);
+            t <<= _backoff;
+            return std::min<unsigned long>(std::max<unsigned long>(t, _min_timeout), _max_timeout);
+        }
+        bool measured() const
+        {
+            return _samples > 0;
+        }
+        unsigned long srtt() const
+        {
+            return _srtt;
+        }
+        unsigned long rttvar() const
+        {
+            return _rttvar;
+        }
+        uint32_t samples() const
+        {
+            return _samples;
+        }
+        uint32_t timeouts() const
+        {
+            return _timeouts;
+        }
+
+        uint16_t _min_timeout;
+        uint16_t _max_timeout;
+        uint16_t _granularity;
+
+    private:
+        static constexpr uint8_t max_backoff = 4;
+        unsigned long _srtt = 0;
+        unsigned long _rttvar = 0;
+        uint32_t _samples = 0;
+        uint32_t _timeouts = 0;
+        uint8_t _backoff = 0;
+    };
+}
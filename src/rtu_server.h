@@ -0,0 +1,364 @@
+/**
+ * @file      rtu_server.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Modbus RTU server answering the holding register requests of the inverter over a serial link
+ */
+#pragma once
+
+#include "transport.h"
+#include "line_settings.h"
+#include "request_trace.h"
+
+namespace modbus
+{
+    // CRC of a Modbus RTU frame, sent low byte first
+    inline uint16_t crc16(const uint8_t *data, size_t length)
+    {
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (uint8_t b = 0; b < 8; b++)
+                crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+        return crc;
+    }
+
+    // Silent time on the line that ends a frame: 3.5 characters of 11 bits, and 1750 us above 19200 baud
+    inline uint32_t interframeMicros(uint32_t baud)
+    {
+        return baud > 19200 ? 1750 : (38500000 + baud - 1) / baud;
+    }
+
+    // SerialLink. The bytes of the bus, and where the frames on it end.
+    // Implemented by EspSerialLink (esp_transport.h) and PtyLink (native/posix_transport.h).
+    class SerialLink
+    {
+    public:
+        virtual ~SerialLink() = default;
+
+        // Wait until a frame ended: bytes arrived and the line was silent for the interframe time since. At most
+        // timeout ms. Returns false if no frame ended, the bytes of a frame that is still arriving may then be read.
+        virtual bool wait(uint32_t timeout) = 0;
+        // Read what has arrived, up to length bytes, without waiting
+        virtual size_t read(uint8_t *data, size_t length) = 0;
+        virtual bool write(const uint8_t *data, size_t length) = 0;
+        virtual const char *name() const = 0;
+        // Change the speed and framing, what was received is dropped
+        virtual bool configure(const LineSettings &settings) = 0;
+        // Number of bytes received with a framing or parity error
+        virtual uint32_t errors() const = 0;
+    };
+
+    // ResponseCache. Complete response frames, CRC included, of the reads the client keeps repeating.
+    // A frame is stored with the version of its registers and only used while that version is current.
+    // When full, the least recently used frame is replaced.
+    class ResponseCache
+    {
+    public:
+        static constexpr uint8_t size = 8;
+        static constexpr uint16_t max_frame = 5 + 2 * 125;
+
+        struct Entry
+        {
+            uint8_t _slaveId = 0;
+            uint8_t _fc = 0;
+            uint16_t _start = 0;
+            uint16_t _count = 0;
+            uint32_t _version = 0;
+            uint32_t _used = 0;
+            uint16_t _length = 0;
+            uint8_t _frame[max_frame];
+        };
+
+        // The frame of the read, nullptr if it is not cached or its registers changed since
+        const Entry *find(uint8_t slaveId, uint8_t fc, uint16_t start, uint16_t count, uint32_t version)
+        {
+            for (uint8_t i = 0; i < size; i++)
+            {
+                Entry &e = _entries[i];
+                if (e._length > 0 && e._slaveId == slaveId && e._fc == fc && e._start == start && e._count == count && e._version == version)
+                {
+                    e._used = ++_clock;
+                    _hits++;
+                    return &e;
+                }
+            }
+            _misses++;
+            return nullptr;
+        }
+
+        // Keep a frame that was just built, in place of an older frame of the same read or the least recently used one
+        void store(uint8_t slaveId, uint8_t fc, uint16_t start, uint16_t count, uint32_t version, const uint8_t *frame, uint16_t length)
+        {
+            if (length > max_frame)
+                return;
+            Entry *slot = &_entries[0];
+            for (uint8_t i = 0; i < size; i++)
+            {
+                Entry &e = _entries[i];
+                if (e._slaveId == slaveId && e._fc == fc && e._start == start && e._count == count)
+                {
+                    slot = &e;
+                    break;
+                }
+                if (e._used < slot->_used)
+                    slot = &e;
+            }
+            // Field by field, only length bytes of the frame are used
+            slot->_slaveId = slaveId;
+            slot->_fc = fc;
+            slot->_start = start;
+            slot->_count = count;
+            slot->_version = version;
+            slot->_used = ++_clock;
+            slot->_length = length;
+            memcpy(slot->_frame, frame, length);
+        }
+
+        uint32_t hits() const
+        {
+            return _hits;
+        }
+        uint32_t misses() const
+        {
+            return _misses;
+        }
+
+    private:
+        Entry _entries[size];
+        uint32_t _clock = 0;
+        uint32_t _hits = 0;
+        uint32_t _misses = 0;
+    };
+
+    // RtuServer. ServerTransport on a SerialLink, supports reading and writing holding registers (FC 3, 6 and 16).
+    // A frame is taken as complete once the number of bytes its function code implies has arrived, a frame with a
+    // wrong CRC is skipped byte by byte until the start of a valid frame is found. Bytes that are left when the
+    // link reports the end of a frame belong to an incomplete frame and are dropped.
+    // serve() waits for the end of a frame and answers it right away, task() only answers what has arrived.
+    // Up to max_slaves slave IDs are answered, each from its own callbacks. The slave of a request is found with one
+    // lookup in a table indexed by the slave ID, so serving more slaves does not slow down the answer.
+    // Every request to a served slave is recorded in a RequestTrace, see trace().
+    // Responses to reads are kept in a ResponseCache when the slave has a version callback, so a repeated read
+    // of registers that did not change is answered by copying the frame built the previous time.
+    class RtuServer : public ServerTransport
+    {
+    public:
+        RtuServer(SerialLink &link) : _link(link)
+        {
+        }
+        RtuServer(const RtuServer &) = delete;
+        RtuServer &operator=(const RtuServer &) = delete;
+
+        static constexpr uint8_t max_slaves = 4;
+
+        bool slave(uint8_t slaveId, cbRequest request, cbReadHregs read, cbWriteHregs write, cbHregsVersion version) override
+        {
+            // 0 is the broadcast address, which is never answered
+            if (slaveId == 0 || _index[slaveId] != 0 || _number_slaves == max_slaves)
+                return false;
+            _slaves[_number_slaves] = {slaveId, request, read, write, version};
+            _index[slaveId] = ++_number_slaves;
+            return true;
+        }
+        void task() override
+        {
+            receive(false, micros());
+        }
+        // Wait at most timeout ms for the end of a request, then answer it
+        void serve(uint32_t timeout)
+        {
+            bool ended = _link.wait(timeout);
+            receive(ended, micros());
+        }
+
+        const ResponseCache &cache() const
+        {
+            return _cache;
+        }
+        // Frames that ended before all their bytes arrived
+        uint32_t incomplete() const
+        {
+            return _incomplete;
+        }
+        // Requests with a valid CRC, also those to other slaves on the bus
+        uint32_t frames() const
+        {
+            return _frames;
+        }
+        using Trace = RequestTrace<256>;
+        const Trace &trace() const
+        {
+            return _trace;
+        }
+
+    private:
+        static constexpr uint16_t max_read = 125;
+        // arrival is the time the link reported the end of the frame, or task() was called, before the bytes are read
+        void receive(bool ended, uint32_t arrival)
+        {
+            _length += _link.read(_rx + _length, sizeof(_rx) - _length);
+            while (_length >= 4)
+            {
+                size_t frame = frameLength();
+                if (frame == 0)
+                {
+                    // Unknown function code, nothing to resynchronise on
+                    _length = 0;
+                    break;
+                }
+                if (frame > sizeof(_rx))
+                {
+                    consume(1);
+                    continue;
+                }
+                if (_length < frame)
+                    break;
+                uint16_t crc = _rx[frame - 2] | (_rx[frame - 1] << 8);
+                if (crc != crc16(_rx, frame - 2))
+                {
+                    consume(1);
+                    continue;
+                }
+                _frames++;
+                if (_index[_rx[0]] != 0)
+                    process(_slaves[_index[_rx[0]] - 1], arrival);
+                consume(frame);
+            }
+            if (ended && _length > 0)
+            {
+                _incomplete++;
+                _length = 0;
+            }
+        }
+        // Length of the frame at the start of the buffer, 0 if the function code is not known
+        size_t frameLength() const
+        {
+            switch (_rx[1])
+            {
+            case Modbus::FC_READ_COILS:
+            case Modbus::FC_READ_INPUT_STAT:
+            case Modbus::FC_READ_REGS:
+            case Modbus::FC_READ_INPUT_REGS:
+            case Modbus::FC_WRITE_COIL:
+            case Modbus::FC_WRITE_REG:
+                return 8;
+            case Modbus::FC_WRITE_COILS:
+            case Modbus::FC_WRITE_REGS:
+                return _length < 7 ? 7 : 9 + _rx[6];
+            default:
+                return 0;
+            }
+        }
+        void consume(size_t n)
+        {
+            memmove(_rx, _rx + n, _length - n);
+            _length -= n;
+        }
+        struct Handlers
+        {
+            uint8_t _slaveId = 0;
+            cbRequest _cb;
+            cbReadHregs _read;
+            cbWriteHregs _write;
+            cbHregsVersion _version;
+        };
+        void process(const Handlers &h, uint32_t arrival)
+        {
+            const uint8_t *f = _rx;
+            Modbus::FunctionCode fc = Modbus::FunctionCode(f[1]);
+            uint16_t address = (f[2] << 8) | f[3];
+            uint16_t count = fc == Modbus::FC_WRITE_REG ? 1 : (f[4] << 8) | f[5];
+            Modbus::RequestData data(HREG(address), count);
+            Modbus::ResultCode result = h._cb ? h._cb(fc, data) : Modbus::EX_SUCCESS;
+            if (result == Modbus::EX_SUCCESS && fc != Modbus::FC_READ_REGS && fc != Modbus::FC_WRITE_REG && fc != Modbus::FC_WRITE_REGS)
+                result = Modbus::EX_ILLEGAL_FUNCTION;
+            if (result == Modbus::EX_SUCCESS && (count == 0 || count > max_read || (fc == Modbus::FC_WRITE_REGS && f[6] != 2 * count)))
+                result = Modbus::EX_ILLEGAL_VALUE;
+
+            uint32_t version = 0;
+            if (result == Modbus::EX_SUCCESS && fc == Modbus::FC_READ_REGS && h._version)
+            {
+                version = h._version(address, count);
+                const ResponseCache::Entry *e = _cache.find(h._slaveId, fc, address, count, version);
+                if (e)
+                {
+                    send(e->_frame, e->_length);
+                    trace(h._slaveId, fc, address, count, result, arrival);
+                    return;
+                }
+            }
+
+            uint8_t tx[ResponseCache::max_frame];
+            size_t n = 0;
+            tx[n++] = h._slaveId;
+            if (result == Modbus::EX_SUCCESS && fc == Modbus::FC_READ_REGS)
+            {
+                uint16_t values[max_read];
+                result = h._read ? h._read(address, count, values) : Modbus::EX_ILLEGAL_ADDRESS;
+                if (result == Modbus::EX_SUCCESS)
+                {
+                    tx[n++] = fc;
+                    tx[n++] = 2 * count;
+                    for (uint16_t r = 0; r < count; r++)
+                    {
+                        tx[n++] = values[r] >> 8;
+                        tx[n++] = values[r];
+                    }
+                }
+            }
+            else if (result == Modbus::EX_SUCCESS)
+            {
+                const uint8_t *payload = fc == Modbus::FC_WRITE_REG ? f + 4 : f + 7;
+                uint16_t values[max_read];
+                for (uint16_t r = 0; r < count; r++)
+                    values[r] = (payload[2 * r] << 8) | payload[2 * r + 1];
+                result = h._write ? h._write(address, count, values) : Modbus::EX_ILLEGAL_ADDRESS;
+                if (result == Modbus::EX_SUCCESS)
+                {
+                    memcpy(tx + n, f + 1, 5);
+                    n += 5;
+                }
+            }
+            if (result != Modbus::EX_SUCCESS)
+            {
+                tx[n++] = fc | 0x80;
+                tx[n++] = result;
+            }
+            uint16_t crc = crc16(tx, n);
+            tx[n++] = crc;
+            tx[n++] = crc >> 8;
+            if (result == Modbus::EX_SUCCESS && fc == Modbus::FC_READ_REGS && h._version)
+                _cache.store(h._slaveId, fc, address, count, version, tx, n);
+            send(tx, n);
+            trace(h._slaveId, fc, address, count, result, arrival);
+        }
+        void trace(uint8_t slaveId, uint8_t fc, uint16_t address, uint16_t count, Modbus::ResultCode result, uint32_t arrival)
+        {
+            uint32_t response = micros() - arrival;
+            _trace.record({arrival, address, count, uint16_t(std::min<uint32_t>(response, UINT16_MAX)), slaveId, fc,
+                           uint8_t(result == Modbus::EX_SUCCESS ? 0 : result)});
+        }
+        void send(const uint8_t *frame, size_t length)
+        {
+            if (!_link.write(frame, length))
+                Serial.printf("ERROR: response of %u bytes not written to %s\r\n", unsigned(length), _link.name());
+        }
+
+        SerialLink &_link;
+        Handlers _slaves[max_slaves];
+        uint8_t _number_slaves = 0;
+        // Position in _slaves plus one of each slave ID, 0 when it is not served
+        uint8_t _index[256] = {};
+        ResponseCache _cache;
+        uint8_t _rx[9 + 2 * max_read];
+        size_t _length = 0;
+        uint32_t _incomplete = 0;
+        uint32_t _frames = 0;
+        Trace _trace;
+    };
+}
@@ -0,0 +1,249 @@
+/**
+ * @file      scheduler.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Decide when the blocks of a meter are read, earliest deadline first
+ */
+#pragma once
+
+#include <algorithm>
+#include "definitions.h"
+#include "read_planner.h"
+
+namespace modbus
+{
+    // BlockTiming. How well the schedule of a block is met. Lateness is the time between the deadline of a read
+    // (one period after its release) and the arrival of the data. Jitter is the deviation of the time between
+    // two arrivals from the period.
+    struct BlockTiming
+    {
+        uint32_t _completed = 0;
+        uint32_t _late = 0;
+        uint32_t _collapsed = 0;
+        unsigned long _maxLateness = 0;
+        unsigned long _maxJitter = 0;
+        unsigned long _sumJitter = 0;
+        unsigned long _lastCompleted = 0;
+    };
+
+    // Scheduler. Every block with a period is released once per period. A block that is released while a read of
+    // it is still pending or in flight is not queued a second time, the job is collapsed into the outstanding one.
+    // Requests are sent earliest deadline first, with the priority breaking ties.
+    // When a block is released, blocks that are due in less than half their period are released with it, so they share
+    // its request instead of needing one of their own a moment later. Blocks released at a set time are not, but
+    // other blocks that are due wait less than half their period for such a block to be released.
+    template <typename MODBUS_TYPE>
+    class Scheduler
+    {
+    public:
+        static constexpr uint16_t number_blocks = DeviceDescription<MODBUS_TYPE>::number_blocks;
+        static_assert(number_blocks <= 32, "Blocks are kept in a 32 bit mask");
+
+        Scheduler(Span<BlockSchedule<MODBUS_TYPE>> schedule)
+        {
+            for (auto i = schedule.begin(); i < schedule.end(); i++)
+            {
+                Job &j = _jobs[i->_block];
+                j._period = i->_period;
+                j._basePeriod = i->_period;
+                j._priority = i->_priority;
+            }
+        }
+
+        // Release the blocks whose period has elapsed. outstanding holds the blocks that are pending or in flight.
+        // Returns the blocks that have to be read.
+        uint32_t release(unsigned long now, uint32_t outstanding)
+        {
+            uint32_t result = 0;
+            long pinned = -1;
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const Job &j = _jobs[b];
+                long until = j._next - now;
+                if (j._pinned && j._period > 0 && until > 0 && (pinned < 0 || until < pinned))
+                    pinned = until;
+            }
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                Job &j = _jobs[b];
+                if (j._period == 0 || (long)(now - j._next) < 0)
+                    continue;
+                if (!j._pinned && pinned >= 0 && pinned < j._period / 2)
+                    continue;
+                if (outstanding & (uint32_t(1) << b))
+                {
+                    j._timing._collapsed++;
+                }
+                else
+                {
+                    j._deadline = j._next + j._period;
+                    result |= uint32_t(1) << b;
+                }
+                // Do not catch up on missed periods, that would only queue more reads of the same block
+                j._next += j._period;
+                if ((long)(now - j._next) >= 0)
+                    j._next = now + j._period;
+            }
+            if (result == 0)
+                return result;
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                Job &j = _jobs[b];
+                uint32_t bit = uint32_t(1) << b;
+                if (j._period == 0 || j._pinned || ((result | outstanding) & bit) || (long)(j._next - now) >= j._period / 2)
+                    continue;
+                // Stay on the grid of the block, so it is read earlier but not more often
+                j._deadline = j._next + j._period;
+                j._next += j._period;
+                result |= bit;
+            }
+            return result;
+        }
+
+        // Time until release has a block to release, at most limit. A block that waits for a block released at a
+        // set time is released with it.
+        unsigned long nextRelease(unsigned long now, unsigned long limit) const
+        {
+            long pinned = -1;
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const Job &j = _jobs[b];
+                long until = j._next - now;
+                if (j._pinned && j._period > 0 && until > 0 && (pinned < 0 || until < pinned))
+                    pinned = until;
+            }
+            unsigned long result = limit;
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                const Job &j = _jobs[b];
+                if (j._period == 0)
+                    continue;
+                long until = std::max(long(j._next - now), 0l);
+                if (!j._pinned && pinned >= 0 && pinned < j._period / 2)
+                    until = std::max(until, pinned);
+                result = std::min(result, (unsigned long)until);
+            }
+            return result;
+        }
+
+        // Release a block next at the given time, and from then on every period
+        void releaseAt(uint16_t block, unsigned long next, uint16_t period)
+        {
+            Job &j = _jobs[block];
+            j._next = next;
+            j._period = period;
+            j._pinned = true;
+        }
+
+        // Read a block as soon as possible, outside its period
+        void request(uint16_t block, unsigned long now)
+        {
+            _jobs[block]._deadline = now;
+        }
+
+        // Order the requests earliest deadline first, the priority breaking ties. A request covering several blocks
+        // takes the earliest deadline and the highest priority of its blocks.
+        void order(ReadRequest *requests, uint8_t n) const
+        {
+            for (uint8_t i = 1; i < n; i++)
+            {
+                ReadRequest r = requests[i];
+                uint8_t j = i;
+                for (; j > 0 && before(r, requests[j - 1]); j--)
+                    requests[j] = requests[j - 1];
+                requests[j] = r;
+            }
+        }
+
+        // The data of a block arrived
+        void completed(uint16_t block, unsigned long now)
+        {
+            Job &j = _jobs[block];
+            BlockTiming &t = j._timing;
+            long lateness = now - j._deadline;
+            if (lateness > 0)
+            {
+                t._late++;
+                t._maxLateness = std::max(t._maxLateness, (unsigned long)lateness);
+            }
+            if (t._completed > 0 && j._period > 0)
+            {
+                long jitter = (long)(now - t._lastCompleted) - j._period;
+                unsigned long absJitter = jitter < 0 ? -jitter : jitter;
+                t._maxJitter = std::max(t._maxJitter, absJitter);
+                t._sumJitter += absJitter;
+            }
+            t._completed++;
+            t._lastCompleted = now;
+        }
+
+        const BlockTiming &timing(uint16_t block) const
+        {
+            return _jobs[block]._timing;
+        }
+        uint16_t period(uint16_t block) const
+        {
+            return _jobs[block]._period;
+        }
+        // True if the block is released at a set time, see releaseAt
+        bool pinned(uint16_t block) const
+        {
+            return _jobs[block]._pinned;
+        }
+        // The period from the schedule table
+        uint16_t basePeriod(uint16_t block) const
+        {
+            return _jobs[block]._basePeriod;
+        }
+        // Change the period of a block. A block that was not read periodically is released right away.
+        void setPeriod(uint16_t block, uint16_t period, unsigned long now)
+        {
+            Job &j = _jobs[block];
+            j._pinned = false;
+            if (j._period == 0 && period > 0)
+                j._next = now;
+            else if (period < j._period && (long)(j._next - (now + period)) > 0)
+                j._next = now + period;
+            j._period = period;
+        }
+
+    private:
+        struct Job
+        {
+            uint16_t _period = 0;
+            uint16_t _basePeriod = 0;
+            uint8_t _priority = UINT8_MAX;
+            bool _pinned = false;
+            unsigned long _next = 0;
+            unsigned long _deadline = 0;
+            BlockTiming _timing;
+        };
+        void key(const ReadRequest &r, unsigned long &deadline, uint8_t &priority) const
+        {
+            bool first = true;
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                if (!(r._blocks & (uint32_t(1) << b)))
+                    continue;
+                const Job &j = _jobs[b];
+                if (first || (long)(j._deadline - deadline) < 0)
+                    deadline = j._deadline;
+                if (first || j._priority < priority)
+                    priority = j._priority;
+                first = false;
+            }
+        }
+        bool before(const ReadRequest &a, const ReadRequest &b) const
+        {
+            unsigned long da = 0, db = 0;
+            uint8_t pa = 0, pb = 0;
+            key(a, da, pa);
+            key(b, db, pb);
+            long d = da - db;
+            return d < 0 || (d == 0 && pa < pb);
+        }
+        Job _jobs[number_blocks];
+    };
+}
@@ -9,7 +9,10 @@
 #pragma once
 
 #include "definitions.h"
-#include "ModbusRTU.h"
+#include "demand.h"
+#include "transport.h"
+#include "spsc_queue.h"
+#include <atomic>
 
 namespace modbus
 {
@@ -17,31 +20,95 @@ namespace modbus
     class Slave
     {
     public:
-        Slave(ModbusRTU &rtu, uint8_t slaveId) : _dd(MODBUS_TYPE::getDeviceDescription()), _rtu(rtu)
+        Slave(ServerTransport &rtu, uint8_t slaveId) : _dd(MODBUS_TYPE::getDeviceDescription()), _rtu(rtu)
         {
-            createRegistersInModbusDevice();
-            _rtu.slave(slaveId);
-            _rtu.onRequest(myOnRequest);
+            createRegisterImage();
+            // Routed to this instance. A lambda capturing only this is stored inside the std::function itself
+            bool served = _rtu.slave(
+                slaveId,
+                [this](Modbus::FunctionCode fc, const Modbus::RequestData data)
+                { return onRequest(fc, data); },
+                [this](uint16_t offset, uint16_t count, uint16_t *values)
+                { return readRegisters(offset, count, values); },
+                [this](uint16_t offset, uint16_t count, const uint16_t *values)
+                { return writeRegisters(offset, count, values); },
+                [this](uint16_t offset, uint16_t count)
+                { return version(offset, count); });
+            if (!served)
+                Serial.printf("ERROR: slave %u is not served, the ID is taken or too many slaves\r\n", slaveId);
         }
+        // Requests call back into this instance, so it can not be copied
+        Slave(const Slave &) = delete;
+        Slave &operator=(const Slave &) = delete;
 
+        // Values are set in a shadow image and reach the inverter together on publish(), so it never reads a float
+        // of which only one word was updated, or a block that mixes old and new values.
         using RegisterType = typename MODBUS_TYPE::e_registers;
         void setFloatValue(RegisterType r, float i)
         {
-            RegisterReference rr = _dd.getRegisterReference(r);
-            if (rr._block_idx >= 0 && rr._register_idx >= 0)
-            {
-                modbus::Value v;
-                v.f32 = i;
-                modbus::Register r = _dd._blocks[rr._block_idx]._registers[rr._register_idx];
-                _rtu.Reg(TAddress({TAddress::HREG, r._offset}), v.w1);
-                _rtu.Reg(TAddress({TAddress::HREG, uint16_t(r._offset + 1)}), v.w2);
-                // Serial.printf("setFloatValue %s %i %i=%f\r\n", rr._name, rr._block_idx, rr._register_idx, i);
-            }
-            else
+            const RegisterReference &rr = _dd.getRegisterReference(r);
+            setFloatAt(rr._block_idx, _start[rr._block_idx] + rr._word, i);
+        }
+        // Variant with the position in the image resolved at compile time, used on the conversion path
+        template <RegisterType R>
+        void setFloatValue(float i)
+        {
+            constexpr const DeviceDescription<MODBUS_TYPE> &dd = MODBUS_TYPE::getDeviceDescription();
+            constexpr uint8_t block = dd.getRegisterReference(R)._block_idx;
+            constexpr uint16_t index = dd.firstWord(block) + dd.getRegisterReference(R)._word;
+            static_assert(dd.getRegister(R)._dataType == DataType::float32, "setFloatValue requires a float32 register");
+            setFloatAt(block, index, i);
+        }
+
+        // Set a register the converter does not set, e.g. the configuration of the device. Like a write of the
+        // inverter it is served right away.
+        void setValue(RegisterType r, Value v)
+        {
+            const Register &reg = _dd.getRegister(r);
+            uint16_t words[2] = {v.w1, v.w2};
+            writeRegisters(reg._offset, reg._number, words);
+        }
+
+        // Make the values set since the previous publish visible to the inverter, all at once
+        void publish()
+        {
+            uint32_t swaps = _swaps.load(std::memory_order_relaxed);
+            uint8_t front = (swaps + 1) & 1;
+            bool staged = false;
+            for (uint16_t b = 0; b < number_blocks; b++)
+                staged = staged || _staged[b];
+            if (!staged)
+                return;
+            _swaps.store(swaps + 1, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_release);
+            _published++;
+            // Only now the responses cached for the old image become invalid. The new shadow starts as a copy
+            // of what is served, only the staged blocks differ. A reader still copying from it sees _swaps
+            // changed and reads again.
+            for (uint16_t b = 0; b < number_blocks; b++)
             {
-                Serial.printf("modbus::ConvertEM24ToWattNode::setFloatValue invalid reference for register %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                if (!_staged[b])
+                    continue;
+                _staged[b] = false;
+                _changes[b]++;
+                const Block &block = _dd.blocks()[b];
+                memcpy(_images[front ^ 1] + _start[b], _images[front] + _start[b], block._number_reg * sizeof(uint16_t));
             }
         }
+        // Number of publishes that changed a value
+        uint32_t published() const
+        {
+            return _published;
+        }
+
+        // Record the reads the RTU side queued in _demand. Called by the task that schedules the meter reads,
+        // so _demand is only written by that task.
+        void takeReads()
+        {
+            ClientRead r;
+            while (_reads.pop(r))
+                _demand.record(r._offset, r._count, r._time);
+        }
 
         String getValueAsString(const Register &r) const
         {
@@ -70,14 +137,19 @@ namespace modbus
         modbus::Value getValue(const Register &r) const
         {
             modbus::Value v;
+            int32_t index = locate(r._offset, r._number)._index;
+            if (index < 0)
+                return v;
+            uint16_t words[2];
+            readImage(index, r._number, words);
             switch (r._number)
             {
             case 1:
-                v.w = _rtu.Reg(TAddress({TAddress::HREG, r._offset}));
+                v.w = words[0];
                 break;
             case 2:
-                v.w1 = _rtu.Reg(TAddress({TAddress::HREG, r._offset}));
-                v.w2 = _rtu.Reg(TAddress({TAddress::HREG, uint16_t(r._offset + 1)}));
+                v.w1 = words[0];
+                v.w2 = words[1];
             }
             return v;
         }
@@ -86,14 +158,14 @@ namespace modbus
         {
             String r = "";
             char buf[200];
-            for (auto i = _dd._blocks.begin(); i < _dd._blocks.end(); i++)
+            for (auto i = _dd.blocks().begin(); i < _dd.blocks().end(); i++)
             {
-                sprintf(buf, "Block %s\r\n", i->_name.c_str());
+                sprintf(buf, "Block %s\r\n", i->_name);
                 r += buf;
-                for (auto j = i->_registers.begin(); j < i->_registers.end(); j++)
+                for (auto j = _dd.registers(*i).begin(); j < _dd.registers(*i).end(); j++)
                 {
                     String v = getValueAsString(*j);
-                    sprintf(buf, "  %s=%s %s\r\n", j->_desc.c_str(), v.c_str(), j->_unit);
+                    sprintf(buf, "  %s=%s %s\r\n", j->_desc, v.c_str(), j->_unit);
                     r += buf;
                 }
             }
@@ -101,33 +173,148 @@ namespace modbus
         }
 
         const DeviceDescription<MODBUS_TYPE> &_dd;
+        // Which blocks the client reads and how often
+        ReadDemand<MODBUS_TYPE> _demand;
+
     private:
-        ModbusRTU &_rtu;
-        static Modbus::ResultCode myOnRequest(Modbus::FunctionCode fc, const Modbus::RequestData data)
+        static constexpr uint16_t number_blocks = DeviceDescription<MODBUS_TYPE>::number_blocks;
+
+        // A value that did not change does not stage its block, so the cached responses stay valid
+        void setFloatAt(uint8_t block, uint16_t index, float i)
+        {
+            modbus::Value v;
+            v.f32 = i;
+            uint16_t *shadow = _images[(_swaps.load(std::memory_order_relaxed) + 1) & 1];
+            if (shadow[index] == v.w1 && shadow[index + 1] == v.w2)
+                return;
+            shadow[index] = v.w1;
+            shadow[index + 1] = v.w2;
+            _staged[block] = true;
+        }
+        ServerTransport &_rtu;
+        // The words of all blocks, block b starts at _start[b]. Blocks are in address order, so blocks that follow
+        // each other in the address space also follow each other here.
+        // The inverter is served from _images[_swaps % 2], the other one is the shadow the values are set in.
+        uint16_t _images[2][MODBUS_TYPE::getDeviceDescription().numberWords()] = {};
+        std::atomic<uint32_t> _swaps{0};
+        uint16_t _start[number_blocks];
+        // Blocks changed in the shadow since the last publish
+        bool _staged[number_blocks] = {};
+        uint32_t _published = 0;
+        // Number of published changes per block, the version of a range is the sum over its blocks
+        std::atomic<uint32_t> _changes[number_blocks] = {};
+        // Reads of the inverter, from the RTU side to takeReads
+        struct ClientRead
+        {
+            uint16_t _offset;
+            uint16_t _count;
+            unsigned long _time;
+        };
+        SpscQueue<ClientRead, 16> _reads;
+
+        // Copy count words from index in the served image. Copied again when a publish started to overwrite the
+        // image meanwhile, which takes two publishes during one copy.
+        void readImage(int32_t index, uint16_t count, uint16_t *values) const
+        {
+            for (;;)
+            {
+                uint32_t swaps = _swaps.load(std::memory_order_acquire);
+                memcpy(values, _images[swaps & 1] + index, count * sizeof(uint16_t));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (_swaps.load(std::memory_order_relaxed) == swaps)
+                    return;
+            }
+        }
+
+        // Where the words offset..offset+count-1 are: _index in _image, -1 if not all of them are held, and the
+        // blocks from _first to _last they are in. A range may run on into the next block when that block starts
+        // where the previous one ends.
+        struct Location
+        {
+            int32_t _index;
+            uint16_t _first;
+            uint16_t _last;
+        };
+        Location locate(uint16_t offset, uint16_t count) const
+        {
+            Span<Block> blocks = _dd.blocks();
+            for (uint16_t b = 0; b < number_blocks; b++)
+            {
+                if (offset < blocks[b]._offset || offset >= blocks[b]._offset + blocks[b]._number_reg)
+                    continue;
+                uint32_t end = uint32_t(offset) + count;
+                for (uint16_t c = b;; c++)
+                {
+                    uint32_t blockEnd = uint32_t(blocks[c]._offset) + blocks[c]._number_reg;
+                    if (end <= blockEnd)
+                        return {int32_t(_start[b] + offset - blocks[b]._offset), b, c};
+                    if (c + 1 == number_blocks || blocks[c + 1]._offset != blockEnd)
+                        break;
+                }
+                break;
+            }
+            return {-1, 0, 0};
+        }
+        Modbus::ResultCode readRegisters(uint16_t offset, uint16_t count, uint16_t *values) const
+        {
+            Location l = locate(offset, count);
+            if (l._index < 0)
+                return Modbus::EX_ILLEGAL_ADDRESS;
+            readImage(l._index, count, values);
+            return Modbus::EX_SUCCESS;
+        }
+        Modbus::ResultCode writeRegisters(uint16_t offset, uint16_t count, const uint16_t *values)
+        {
+            Location l = locate(offset, count);
+            if (l._index < 0)
+                return Modbus::EX_ILLEGAL_ADDRESS;
+            // Written to both images, a value the inverter writes is served right away and kept by the next publish.
+            // The inverter only writes configuration registers, which the converter does not set.
+            memcpy(_images[0] + l._index, values, count * sizeof(uint16_t));
+            memcpy(_images[1] + l._index, values, count * sizeof(uint16_t));
+            for (uint16_t b = l._first; b <= l._last; b++)
+                _changes[b]++;
+            return Modbus::EX_SUCCESS;
+        }
+        uint32_t version(uint16_t offset, uint16_t count) const
+        {
+            Location l = locate(offset, count);
+            uint32_t v = 0;
+            for (uint16_t b = l._first; l._index >= 0 && b <= l._last; b++)
+                v += _changes[b];
+            return v;
+        }
+        Modbus::ResultCode onRequest(Modbus::FunctionCode fc, const Modbus::RequestData data)
         {
-            // Serial.printf("myOnRequest %i %i %i %i\n\r", fc, data.reg.type, data.reg.address, data.regCount);
+            if (fc == Modbus::FC_READ_REGS)
+                _reads.push({data.reg.address, data.regCount, millis()});
             return Modbus::EX_SUCCESS;
         }
-        void createRegistersInModbusDevice()
+        // Lay out the blocks in the images and fill both with the defaults
+        void createRegisterImage()
         {
-            for (auto i = _dd._blocks.begin(); i < _dd._blocks.end(); i++)
+            for (uint16_t b = 0; b < number_blocks; b++)
             {
-                for (auto j = i->_registers.begin(); j < i->_registers.end(); j++)
+                const Block &block = _dd.blocks()[b];
+                _start[b] = _dd.firstWord(b);
+                for (auto j = _dd.registers(block).begin(); j < _dd.registers(block).end(); j++)
                 {
+                    uint16_t index = _start[b] + j->_offset - block._offset;
                     switch (j->_number)
                     {
                     case 1:
-                        _rtu.addHreg(j->_offset, j->_default.w);
+                        _images[0][index] = j->_default.w;
                         break;
                     case 2:
-                        _rtu.addHreg(j->_offset, j->_default.w1);
-                        _rtu.addHreg(j->_offset + 1, j->_default.w2);
+                        _images[0][index] = j->_default.w1;
+                        _images[0][index + 1] = j->_default.w2;
                         break;
                     default:
                         Serial.printf("error\r\n");
                     }
                 }
             }
+            memcpy(_images[1], _images[0], sizeof(_images[0]));
         }
     };
 }
\ No newline at end of file
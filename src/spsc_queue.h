@@ -0,0 +1,61 @@
+/**
+ * @file      spsc_queue.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Fixed size queue between two tasks, without locks
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace modbus
+{
+    // SpscQueue. Queue of at most N items from one producer task to one consumer task. The producer only moves
+    // _head and the consumer only moves _tail, so neither has to wait for the other. An item pushed while the
+    // queue is full is dropped and counted.
+    template <typename T, uint32_t N>
+    class SpscQueue
+    {
+    public:
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+        // Producer side
+        bool push(const T &item)
+        {
+            uint32_t head = _head.load(std::memory_order_relaxed);
+            if (head - _tail.load(std::memory_order_acquire) == N)
+            {
+                _dropped++;
+                return false;
+            }
+            _items[head & (N - 1)] = item;
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side
+        bool pop(T &item)
+        {
+            uint32_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail == _head.load(std::memory_order_acquire))
+                return false;
+            item = _items[tail & (N - 1)];
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        uint32_t dropped() const
+        {
+            return _dropped;
+        }
+
+    private:
+        T _items[N];
+        std::atomic<uint32_t> _head{0};
+        std::atomic<uint32_t> _tail{0};
+        uint32_t _dropped = 0;
+    };
+}
@@ -0,0 +1,88 @@
+/**
+ * @file      transaction_table.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      Fixed capacity lookup of outstanding modbus transactions by transaction id
+ */
+#pragma once
+
+#include <Arduino.h>
+
+namespace modbus
+{
+    // TransactionTable. Open addressed hash table from transaction id to the index of a slot holding the
+    // transaction. Linear probing, and entries are shifted back on erase so no tombstones are needed.
+    // The library hands out transaction ids sequentially and never 0, so 0 marks an empty entry and the
+    // low bits of the id are a good hash. Capacity must be a power of two, at least twice the number of slots.
+    template <uint8_t capacity>
+    class TransactionTable
+    {
+        static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        bool insert(uint16_t id, uint8_t slot)
+        {
+            if (id == 0)
+                return false;
+            for (uint8_t n = 0, i = id & mask; n < capacity; n++, i = (i + 1) & mask)
+            {
+                if (_ids[i] == 0 || _ids[i] == id)
+                {
+                    _ids[i] = id;
+                    _slots[i] = slot;
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Returns the slot of the transaction, or -1 if the id is unknown
+        int16_t find(uint16_t id) const
+        {
+            int16_t i = position(id);
+            return i < 0 ? -1 : _slots[i];
+        }
+        void erase(uint16_t id)
+        {
+            int16_t i = position(id);
+            if (i < 0)
+                return;
+            // Shift back the entries after i that would no longer be found past the gap. In a full table no empty
+            // entry ends the run, it then ends after one pass around the table.
+            uint8_t gap = i;
+            for (uint8_t n = 1, j = (i + 1) & mask; n < capacity && _ids[j] != 0; n++, j = (j + 1) & mask)
+            {
+                uint8_t home = _ids[j] & mask;
+                if (((j - home) & mask) >= ((j - gap) & mask))
+                {
+                    _ids[gap] = _ids[j];
+                    _slots[gap] = _slots[j];
+                    gap = j;
+                }
+            }
+            _ids[gap] = 0;
+        }
+        void clear()
+        {
+            for (uint8_t i = 0; i < capacity; i++)
+                _ids[i] = 0;
+        }
+
+    private:
+        static constexpr uint8_t mask = capacity - 1;
+        int16_t position(uint16_t id) const
+        {
+            if (id == 0)
+                return -1;
+            for (uint8_t n = 0, i = id & mask; n < capacity && _ids[i] != 0; n++, i = (i + 1) & mask)
+            {
+                if (_ids[i] == id)
+                    return i;
+            }
+            return -1;
+        }
+        uint16_t _ids[capacity] = {};
+        uint8_t _slots[capacity] = {};
+    };
+}
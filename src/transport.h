@@ -0,0 +1,60 @@
+/**
+ * @file      transport.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      04-Mar-2025
+ * @note      What the master and the slave need from the Modbus TCP client and the Modbus RTU server
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <Modbus.h>
+#include <functional>
+
+namespace modbus
+{
+    // ClientTransport. Modbus TCP client the Master reads the meter through. Results are reported to the callback
+    // from task(), the same way as modbus-esp8266 does.
+    // Implemented by EspTcpClient (esp_transport.h) and PosixTcpClient (native/posix_transport.h).
+    class ClientTransport
+    {
+    public:
+        virtual ~ClientTransport() = default;
+
+        // Take over fd, a socket connected to remote, as the connection to it. The transport closes it, also when
+        // it returns false.
+        virtual bool attach(const IPAddress &remote, int fd) = 0;
+        virtual bool disconnect(const IPAddress &remote) = 0;
+        virtual bool isConnected(const IPAddress &remote) = 0;
+        // Read input registers. Returns the transaction id passed to the callback, 0 if the request was not sent
+        virtual uint16_t readIreg(const IPAddress &remote, uint16_t offset, uint16_t *values, uint16_t number_reg, cbTransaction cb) = 0;
+        // Cancel all outstanding requests, their callbacks are called with EX_CANCEL
+        virtual void dropTransactions() = 0;
+        virtual void task() = 0;
+        // Socket of the connection to remote, readable when task() has a response to process. -1 if not connected.
+        virtual int socket(const IPAddress &remote) = 0;
+    };
+
+    // ServerTransport. Modbus RTU server answering the inverter from the registers of the Slaves, one per slave ID.
+    // The request callback is called for every request to the slave before it is answered, the request is refused
+    // if it does not return EX_SUCCESS.
+    // The server does not keep the holding registers itself: reads and writes are handed to the callbacks of the
+    // slave, a whole request at a time. They return EX_ILLEGAL_ADDRESS when a range is not held. The version callback
+    // returns a number that changes whenever one of the registers of the range changes.
+    // Implemented by RtuServer (rtu_server.h).
+    class ServerTransport
+    {
+    public:
+        virtual ~ServerTransport() = default;
+
+        using cbReadHregs = std::function<Modbus::ResultCode(uint16_t offset, uint16_t count, uint16_t *values)>;
+        using cbWriteHregs = std::function<Modbus::ResultCode(uint16_t offset, uint16_t count, const uint16_t *values)>;
+        using cbHregsVersion = std::function<uint32_t(uint16_t offset, uint16_t count)>;
+
+        // Answer the requests to slaveId with the callbacks. Returns false if the slave ID is taken or no more
+        // slaves can be served.
+        virtual bool slave(uint8_t slaveId, cbRequest request, cbReadHregs read, cbWriteHregs write, cbHregsVersion version) = 0;
+        virtual void task() = 0;
+    };
+}